@@ -1,379 +1,7269 @@
-#ifndef DOWNLOADER_H
-#define DOWNLOADER_H
-
-#include <QObject>
-#include <QNetworkAccessManager>
-#include <QNetworkReply>
-#include <QFile>
-#include <QUrl>
-#include <QMutex>
-
-class Downloader : public QObject {
-    Q_OBJECT
-
-public:
-    explicit Downloader(QNetworkAccessManager *manager, const QString &url, QObject *parent = nullptr);
-    void startDownload();
-    void pauseDownload();
-    void resumeDownload();
-    void createProgressFile();
-    void updateProgressFile(qint64 bytesReceived, qint64 bytesTotal);
-
-    // Getter for downloadedBytes
-    qint64 getDownloadedBytes() const { return downloadedBytes; }
-
-signals:
-    void downloadFinished(const QString &filePath);
-    void downloadFailed(const QString &error);
-    void downloadProgress(qint64 bytesReceived, qint64 bytesTotal);
-    void pauseResumeStatusChanged(bool paused);
-
-private slots:
-    void onDownloadFinished();
-    void onDownloadProgress(qint64 bytesReceived, qint64 bytesTotal);
-
-private:
-    QNetworkAccessManager *networkManager;
-    QString downloadUrl;
-    QNetworkReply *reply;
-    QFile *file;
-    QFile *progressFile;
-    qint64 downloadedBytes;
-    QMutex mutex;
-    bool paused;
-};
-
-#endif // DOWNLOADER_H
-
-Downloader.cpp
-#include "downloader.h"
-#include <QDir>
-#include <QTextStream>
-
-Downloader::Downloader(QNetworkAccessManager *manager, const QString &url, QObject *parent)
-    : QObject(parent), networkManager(manager), downloadUrl(url), reply(nullptr), file(nullptr),
-      progressFile(nullptr), downloadedBytes(0), paused(false) {}
-
-void Downloader::startDownload() {
-    QMutexLocker locker(&mutex);  // Ensure thread safety
-    QUrl url(downloadUrl);
-    QString filePath = QDir::homePath() + "/qt_downloads/" + url.fileName();
-    file = new QFile(filePath);
-
-    if (!file || !file->open(QIODevice::WriteOnly)) { 
-        emit downloadFailed("Failed to open file for writing.");
-        return;
-    }
-
-    // Check if progress file already exists before creating it
-    QDir progressDir(QDir::homePath() + "/progress");
-    if (!progressDir.exists()) {
-        progressDir.mkpath(".");
-    }
-
-    QString progressFilePath = progressDir.filePath(QUrl(downloadUrl).fileName() + ".progress");
-    if (!QFile::exists(progressFilePath)) {
-        createProgressFile();  // Create the progress file if it doesn't exist
-    }
-
-    downloadedBytes = file->size();
-
-    QNetworkRequest request(url);
-    request.setRawHeader("Range", "bytes=" + QByteArray::number(downloadedBytes) + "-");
-    reply = networkManager->get(request);
-
-    connect(reply, &QNetworkReply::finished, this, &Downloader::onDownloadFinished);
-    connect(reply, &QNetworkReply::downloadProgress, this, &Downloader::onDownloadProgress);
-}
-
-void Downloader::pauseDownload() {
-    QMutexLocker locker(&mutex);  // Ensure thread safety
-    if (!paused && reply) {
-        paused = true;
-        disconnect(reply, &QNetworkReply::downloadProgress, this, &Downloader::onDownloadProgress);
-        disconnect(reply, &QNetworkReply::finished, this, &Downloader::onDownloadFinished);
-        reply->abort();
-
-        qint64 totalBytes = reply->header(QNetworkRequest::ContentLengthHeader).toLongLong();
-
-        if (progressFile && progressFile->open(QIODevice::WriteOnly | QIODevice::Text)) {
-            QTextStream stream(progressFile);
-            stream << "Download URL: " << downloadUrl << "\n";
-            stream << "Downloaded: " << downloadedBytes << " / " << totalBytes << "\n";
-            stream << "Status: paused\n";  // Mark as paused
-            progressFile->close();
-        }
-
-        emit pauseResumeStatusChanged(true);
-    }
-}
-
-void Downloader::resumeDownload() {
-    QMutexLocker locker(&mutex);  // Ensure thread safety
-    if (paused) {
-        paused = false;
-
-        connect(reply, &QNetworkReply::downloadProgress, this, &Downloader::onDownloadProgress);
-        connect(reply, &QNetworkReply::finished, this, &Downloader::onDownloadFinished);
-        startDownload();
-        emit pauseResumeStatusChanged(false);
-    }
-}
-
-void Downloader::onDownloadFinished() {
-    QMutexLocker locker(&mutex);  // Ensure thread safety
-    if (reply->error() == QNetworkReply::NoError) {
-        if (file->open(QIODevice::WriteOnly)) {
-            file->write(reply->readAll());
-            file->close();
-        }
-
-        if (progressFile && progressFile->open(QIODevice::WriteOnly | QIODevice::Text)) {
-            QTextStream stream(progressFile);
-            stream << "Download URL: " << downloadUrl << "\n";
-            stream << "Downloaded: " << downloadedBytes << " / " << downloadedBytes << "\n";
-            stream << "Status: completed\n";  // Mark as completed
-            progressFile->close();
-
-            QFile::remove(progressFile->fileName());
-            delete progressFile;
-            progressFile = nullptr;
-        }
-
-        emit downloadFinished(file->fileName());
-    } else {
-        emit downloadFailed(reply->errorString());
-    }
-    reply->deleteLater();
-}
-
-void Downloader::onDownloadProgress(qint64 bytesReceived, qint64 bytesTotal) {
-    QMutexLocker locker(&mutex);  // Ensure thread safety
-
-    downloadedBytes = bytesReceived;  // Update the total downloaded 
-    if (file->open(QIODevice::WriteOnly)) {
-        file->write(reply->readAll());
-        file->close();
-    }
-
-    if (bytesTotal > 0) {  // Prevent division by zero
-        emit downloadProgress(downloadedBytes, bytesTotal);  // Emit progress signal
-    } else {
-        emit downloadProgress(downloadedBytes, 1);  // Use a placeholder value if total size isn't available
-    }
-
-    updateProgressFile(downloadedBytes, bytesTotal);  // Update the progress file with current status
-}
-
-void Downloader::createProgressFile() {
-    QMutexLocker locker(&mutex);  // Ensure thread safety
-    QDir progressDir(QDir::homePath() + "/progress");
-    if (!progressDir.exists()) {
-        progressDir.mkpath(".");
-    }
-
-    QString progressFilePath = progressDir.filePath(QUrl(downloadUrl).fileName() + ".progress");
-    progressFile = new QFile(progressFilePath);
-    if (progressFile->open(QIODevice::WriteOnly)) {
-        QTextStream stream(progressFile);
-        stream << "Download URL: " << downloadUrl << "\n";
-        stream << "Downloaded: 0\n";
-        stream << "Status: in-progress\n";  // Set the status as in-progress
-        progressFile->close();
-    }
-}
-
-void Downloader::updateProgressFile(qint64 bytesReceived, qint64 bytesTotal) {
-    QMutexLocker locker(&mutex);  // Ensure thread safety
-    if (progressFile && progressFile->open(QIODevice::WriteOnly | QIODevice::Text)) {
-        QTextStream stream(progressFile);
-        stream << "Download URL: " << downloadUrl << "\n";
-        stream << "Downloaded: " << bytesReceived << " / " << bytesTotal << "\n";
-        stream << "Status: in-progress\n";  // Update status to in-progress
-        progressFile->close();
-    }
-}
-Downloadthread.h
-#ifndef DOWNLOADTHREAD_H
-#define DOWNLOADTHREAD_H
-
-#include <QThread>
-#include <QNetworkAccessManager>
-#include <QString>
-#include "downloader.h"
-
-class DownloadThread : public QThread {
-    Q_OBJECT
-
-public:
-    explicit DownloadThread(QNetworkAccessManager *manager, const QString &url, QObject *parent = nullptr);
-    void run() override;
-    void pauseDownload();
-    void resumeDownload();
-
-signals:
-    void downloadFinished(const QString &filePath);
-    void downloadFailed(const QString &error);
-    void downloadProgress(qint64 bytesReceived, qint64 bytesTotal);
-    void pauseResumeStatusChanged(bool paused);
-
-private:
-    QNetworkAccessManager *networkManager;
-    QString downloadUrl;
-    Downloader *downloader;
-};
-
-#endif // DOWNLOADTHREAD_H
-
-Downloadthread.cpp
-#include "downloadthread.h"
-
-DownloadThread::DownloadThread(QNetworkAccessManager *manager, const QString &url, QObject *parent)
-    : QThread(parent), networkManager(manager), downloadUrl(url), downloader(nullptr) {}
-
-void DownloadThread::run() {
-    downloader = new Downloader(networkManager, downloadUrl);
-    connect(downloader, &Downloader::downloadFinished, this, &DownloadThread::downloadFinished);
-    connect(downloader, &Downloader::downloadFailed, this, &DownloadThread::downloadFailed);
-    connect(downloader, &Downloader::downloadProgress, this, &DownloadThread::downloadProgress);
-    connect(downloader, &Downloader::pauseResumeStatusChanged, this, &DownloadThread::pauseResumeStatusChanged);
-
-    downloader->startDownload();
-    exec();
-}
-
-void DownloadThread::pauseDownload() {
-    if (downloader) {
-        downloader->pauseDownload();
-    }
-}
-
-void DownloadThread::resumeDownload() {
-    if (downloader) {
-        downloader->resumeDownload();
-    }
-}
-
-
-Main.cpp
-#include "downloadthread.h"
-#include <QApplication>
-#include <QPushButton>
-#include <QVBoxLayout>
-#include <QWidget>
-#include <QProgressBar>
-#include <QLineEdit>
-#include <QLabel>
-#include <QNetworkAccessManager>
-#include <QDir>
-#include <QFile>
-#include <QTextStream>
-#include <QMutexLocker>
-#include <QStringList>
-
-void startDownload(const QString &url, QVBoxLayout *layout, QNetworkAccessManager *networkManager, QWidget *window) {
-    QVBoxLayout *downloadLayout = new QVBoxLayout();
-    QLabel *urlLabel = new QLabel(url, window);
-    QProgressBar *progressBar = new QProgressBar(window);
-    QPushButton *pauseResumeButton = new QPushButton("Pause", window);
-
-    DownloadThread *downloadThread = new DownloadThread(networkManager, url, window);
-
-    progressBar->setRange(0, 100);
-    progressBar->setValue(0);
-
-    downloadLayout->addWidget(urlLabel);
-    downloadLayout->addWidget(progressBar);
-    downloadLayout->addWidget(pauseResumeButton);
-
-    layout->addLayout(downloadLayout);
-
-    QObject::connect(downloadThread, &DownloadThread::downloadProgress, [&](qint64 bytesReceived, qint64 bytesTotal) {
-    if (bytesTotal == 0) {
-        // Handle indeterminate state
-        progressBar->setValue(0);  // Default to 0, or use progressBar->setRange(0, 0) for a "busy" indicator
-    } else {
-        // Normal progress calculation
-        progressBar->setValue(static_cast<int>((bytesReceived * 100) / bytesTotal));
-    }
-});
-
-    QObject::connect(downloadThread, &DownloadThread::downloadFinished, [&](const QString &fileName) {
-    urlLabel->setText("Downloaded: " + fileName);
-    progressBar->setValue(100);
-    pauseResumeButton->setDisabled(true);
-
-    // Manual termination of the thread
-    downloadThread->quit();
-    downloadThread->wait();
-    downloadThread->deleteLater();  // Use Qt's deferred deletion to clean up safely
-});
-
-// Slot to handle start download button click
-void onStartDownloadButtonClicked(QLineEdit *urlInput, QVBoxLayout *layout, QNetworkAccessManager *networkManager, QWidget *window) {
-    QString inputUrls = urlInput->text();  // Get comma-separated URLs
-    QStringList urls = inputUrls.split(",", QString::SkipEmptyParts);  // Split into list of URLs
-
-    for (const QString &url : urls) {
-        startDownload(url.trimmed(), layout, networkManager, window);  // Start download for each URL
-    }
-}
-
-// Function to load unfinished downloads (optional)
-void loadUnfinishedDownloads(QVBoxLayout *layout, QWidget *window, QNetworkAccessManager *networkManager) {
-    QDir progressDir(QDir::homePath() + "/progress");
-    if (progressDir.exists()) {
-        QStringList progressFiles = progressDir.entryList(QDir::Files);
-        for (const QString &progressFileName : progressFiles) {
-            QFile progressFile(progressDir.filePath(progressFileName));
-            if (progressFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
-                QTextStream stream(&progressFile);
-                QString url;
-                qint64 downloadedBytes = 0;
-                QString status;  // Add a variable to track the status
-
-                while (!stream.atEnd()) {
-                    QString line = stream.readLine();
-                    if (line.startsWith("Download URL:")) {
-                        url = line.section(":", 1).trimmed();
-                    } else if (line.startsWith("Downloaded:")) {
-                        downloadedBytes = line.section(":", 1).trimmed().toLongLong();
-                    } else if (line.startsWith("Status:")) {  // New line for status
-                        status = line.section(":", 1).trimmed();
-                    }
-                }
-
-                if (!url.isEmpty() && status != "in-progress") {  // Only resume if not in-progress
-                    startDownload(url, layout, networkManager, window);
-                }
-            }
-        }
-    }
-}
-int main(int argc, char *argv[]) {
-    QApplication a(argc, argv);
-
-    QWidget window;
-    QVBoxLayout *layout = new QVBoxLayout(&window);
-    QNetworkAccessManager *networkManager = new QNetworkAccessManager(&window);
-
-    window.setWindowTitle("Download Manager");
-    window.setLayout(layout);
-    window.resize(400, 300);
-
-    QLineEdit *urlInput = new QLineEdit(&window);
-    QPushButton *startDownloadButton = new QPushButton("Start Download", &window);
-
-    layout->addWidget(urlInput);
-    layout->addWidget(startDownloadButton);
-
-    QObject::connect(startDownloadButton, &QPushButton::clicked, [&]() {
-        onStartDownloadButtonClicked(urlInput, layout, networkManager, &window);
-    });
-
-    loadUnfinishedDownloads(layout, &window, networkManager);
-
-    window.show();
-
-    return a.exec();
-}
+#ifndef DOWNLOADER_H
+#define DOWNLOADER_H
+
+#include <QObject>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QFile>
+#include <QUrl>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QRecursiveMutex>
+#include <QElapsedTimer>
+#include <QCryptographicHash>
+#include <QTextStream>
+#include <QHostAddress>
+#include "diskwritepacer.h"
+#include "rateestimator.h"
+#include "peercache.h"
+#include "filecipher.h"
+#include "downloadregistry.h"
+
+class PeerFetch;
+
+// When file data and the .progress journal are forced to stable storage
+enum class DurabilityPolicy {
+    None,       // Leave it to the kernel's writeback
+    Periodic,   // Every syncIntervalMsecs: data sync, then a journal record
+    Barrier     // At every checkpoint: data sync, then a journal record
+};
+
+// Per-download settings, filled from the command line in main()
+struct DownloadOptions {
+    bool streaming = false;                   // Sequential-priority mode for readers tailing the file
+    qint64 readAheadBytes = 4 * 1024 * 1024;  // Cap on data buffered in the reply while streaming
+    bool http2 = true;                        // Multiplex over one HTTP/2 connection per host when offered
+    QNetworkRequest::Priority priority = QNetworkRequest::NormalPriority;  // Mapped to the HTTP/2 stream weight
+    bool happyEyeballs = true;                // Race IPv6 and IPv4 connects for new plain-HTTP hosts
+    bool httpCache = false;                   // The manager has a disk cache; make fresh fetches cacheable
+    bool dedup = false;                       // Link completed files to identical earlier downloads
+    qint64 verifyTailBytes = 0;               // On resume, re-fetch and compare this much of the local tail
+    qint64 checkpointBytes = 4 * 1024 * 1024; // Distance between checkpoints recorded in the progress file
+    DurabilityPolicy durability = DurabilityPolicy::None;
+    int syncIntervalMsecs = 1000;             // Period for DurabilityPolicy::Periodic
+    QString targetPath;                       // Where to save; empty for ~/qt_downloads/<file name>
+    int ioPriorityClass = 0;                  // ioprio class for the writer thread: 1 realtime, 2 best-effort, 3 idle; 0 leaves it
+    int ioPriorityLevel = 4;                  // 0 (highest) to 7 within the realtime and best-effort classes
+    int writeLatencyThresholdMsecs = 0;       // Slow down when p99 write latency exceeds this; 0 disables
+    bool peerCache = false;                   // Try LAN peers (PeerCache) before the origin
+    bool pinToNicNode = false;                // Pin worker threads to the NUMA node of NumaPlacement's NIC
+    QByteArray encryptionKey;                 // 32-byte AES-256 key; files are stored encrypted when set
+    int loopLagThresholdMsecs = 0;            // Watch event loops; sample the stack past this lag. 0 disables
+    bool staging = false;                     // Write to StagingMover's scratch tier, then move to targetPath
+    QString journalDir;                       // Where the .progress journal goes; empty for ~/progress
+    bool shared = true;                       // Listed in DownloadRegistry, so the proxy can serve it
+};
+
+class Downloader : public QObject {
+    Q_OBJECT
+
+public:
+    // A download whose size is known and that has neither completed nor failed
+    struct InFlight {
+        QString writePath;   // Scratch copy when staging, else the final path
+        QString finalPath;
+        qint64 totalBytes = 0;
+    };
+
+    explicit Downloader(QNetworkAccessManager *manager, const QString &url, QObject *parent = nullptr);
+    ~Downloader();
+    static QString localPath(const QString &url, const DownloadOptions &options);  // Where the file is written
+    static QString journalPath(const QString &url, const DownloadOptions &options);  // Its .progress journal
+    static QList<InFlight> inFlight();  // Thread-safe; for disk space checks
+    void startDownload();
+    void pauseDownload();
+    void resumeDownload();
+    void createProgressFile();
+    void updateProgressFile(qint64 bytesReceived, qint64 bytesTotal);
+    void setOptions(const DownloadOptions &opts) {
+        options = opts;
+        writePacer.setThresholdMsecs(opts.writeLatencyThresholdMsecs);
+    }
+
+    // Getter for downloadedBytes
+    qint64 getDownloadedBytes() const { return downloadedBytes; }
+
+    // Getter for the offset below which the file on disk is complete and safe to read
+    qint64 getContiguousOffset() const { return contiguousOffset; }
+
+    // Rates of this job (all requests) and of the request in flight
+    const RateEstimator &getJobRate() const { return jobRate; }
+    const RateEstimator &getConnectionRate() const { return connectionRate; }
+
+    // SHA-256 of the file, valid once downloadFinished has been emitted; only computed for
+    // --dedup and the peer cache, and empty otherwise
+    QByteArray getContentHash() const { return contentDigest; }
+
+signals:
+    void downloadFinished(const QString &filePath);
+    void downloadFailed(const QString &error);
+    void downloadProgress(qint64 bytesReceived, qint64 bytesTotal);
+    void pauseResumeStatusChanged(bool paused);
+    void contiguousOffsetChanged(qint64 offset);
+    void rateUpdated(double currentBytesPerSec, double smoothedBytesPerSec, qint64 etaSecs);
+    void responseHeaders(const QList<QNetworkReply::RawHeaderPair> &headers);  // First 2xx response, before its body
+
+private slots:
+    void onDownloadFinished();
+    void onDownloadProgress(qint64 bytesReceived, qint64 bytesTotal);
+    void onReadyRead();
+
+private:
+    void admit();  // Starts the transfer once scratch has room
+    void connectAndSend();
+    void sendRequest();
+    bool isRedirect() const;
+    bool followRedirect();
+    bool drainReply();  // False when a tail mismatch replaced the reply with a new request
+    void scheduleDrain(int delayMsecs);
+    void restartFromZero();
+    void rehashPrefix();
+    bool hashesContent() const { return options.dedup || options.peerCache; }  // Someone uses the digest
+    bool checkTail(QByteArray &data);
+    void backOffToCheckpoint();
+    void syncData();
+    void completeDownload();
+    void publishCompletion(const QString &filePath);
+    void tryPeers();
+    void fetchFromPeers(const QList<PeerCache::PeerOffer> &offers);
+    void writeProgressLines(QTextStream &stream, qint64 bytesReceived, qint64 bytesTotal, qint64 checkpoint,
+                            const QString &status);
+    void writeJournal(qint64 bytesReceived, qint64 bytesTotal, const QString &status);  // Under the durability policy
+    QString journalStatus() const;  // "Status:" of an existing progress file, empty if none
+    bool writeChunk(const QByteArray &data);  // False when the write failed and the download with it
+    void failWrite(const QString &error);
+    void flushMetrics();  // Hands the locally counted bytes to DownloadMetrics
+    void reportTransfer();
+    void trackInFlight(qint64 bytesTotal);
+    void untrackInFlight();
+
+    static QMutex inFlightMutex;  // Guards inFlightDownloads
+    static QHash<const Downloader *, InFlight> inFlightDownloads;
+
+    static const qint64 metricsFlushBytes = 1024 * 1024;
+    static const int metricsFlushMsecs = 100;
+    static const int transferTimeoutMsecs = 60000;  // No bytes for this long fails the request
+
+    QNetworkAccessManager *networkManager;
+    QString downloadUrl;
+    QUrl requestUrl;          // downloadUrl after cached and followed redirects
+    int redirectHops;
+    bool usedCachedRedirect;  // requestUrl came from RedirectCache rather than from this run
+    QNetworkReply *reply;
+    PeerFetch *peerFetch;     // While the file comes from LAN peers instead of reply
+    QFile *file;
+    QFile *progressFile;
+    qint64 downloadedBytes;
+    qint64 resumeOffset;      // File size when the current request was issued
+    qint64 contiguousOffset;  // Bytes flushed to disk from the start of the file
+    qint64 rangeStart;        // First byte asked for; below resumeOffset while the tail is re-verified
+    qint64 lastCheckpoint;    // Offset already on disk when the progress file last recorded it
+    QByteArray expectedTail;  // Local bytes the start of the response must repeat
+    qint64 tailCompared;
+    int tailMismatches;
+    qint64 durableOffset;     // Bytes known to be on stable storage
+    qint64 lastWriteNsecs;    // SyncBatcher clock at the last write, to tell if a batch sync covered it
+    bool barrierPending;      // A checkpoint passed and its journal record has not been written yet
+    QElapsedTimer syncTimer;
+    QHostAddress sourceAddress;  // Local address this request is bound to, if any
+    DiskWritePacer writePacer;
+    RateEstimator jobRate;
+    RateEstimator connectionRate;
+    bool drainScheduled;         // A paced drainReply() is waiting on its timer
+    QElapsedTimer transferTimer;  // Runs while a request is in flight, for the per-host report
+    QString metricsHost;          // Host of downloadUrl, parsed once rather than for every chunk
+    qint64 unreportedBytes;       // Written but not yet counted in DownloadMetrics, which takes a global lock
+    qint64 unreportedNicBytes;    // Of those, written from a CPU on the NIC's node
+    QElapsedTimer metricsTimer;   // Since the last flushMetrics()
+    QCryptographicHash contentHash;  // Fed as bytes are written, so completion needs no re-read
+    qint64 hashedBytes;              // Length of the file prefix contentHash covers
+    QByteArray contentDigest;
+    QByteArray receiveBuffer;  // Reused by drainReply() for every read from the reply
+    FileCipher cipher;         // Only used when options.encryptionKey is set
+    QByteArray cipherBuffer;   // Ciphertext of the chunk being written
+    QSharedPointer<DownloadRegistry::Progress> registryEntry;  // While listed as in flight
+    QRecursiveMutex mutex;    // Recursive: startDownload() and the slots call the progress file helpers
+    bool paused;
+    bool headersReported;      // responseHeaders has been emitted
+    bool inFlightTracked;      // Listed in inFlightDownloads
+    bool http1Active;          // The request in flight is counted by DownloadMetrics::http1TransferStarted()
+    DownloadOptions options;
+};
+
+#endif // DOWNLOADER_H
+
+Downloader.cpp
+#include "downloader.h"
+#include "downloadmetrics.h"
+#include "hostcache.h"
+#include "connectionracer.h"
+#include "redirectcache.h"
+#include "dedupindex.h"
+#include "syncbatcher.h"
+#include "sourceaddresspool.h"
+#include "peerfetch.h"
+#include "numaplacement.h"
+#include "stagingmover.h"
+#include <QAbstractNetworkCache>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QTimer>
+#include <QTextStream>
+
+Downloader::Downloader(QNetworkAccessManager *manager, const QString &url, QObject *parent)
+    : QObject(parent), networkManager(manager), downloadUrl(url), redirectHops(0), usedCachedRedirect(false),
+      reply(nullptr), peerFetch(nullptr), file(nullptr), progressFile(nullptr), downloadedBytes(0), resumeOffset(0),
+      contiguousOffset(0), rangeStart(0), lastCheckpoint(0), tailCompared(0), tailMismatches(0), durableOffset(0),
+      lastWriteNsecs(0), barrierPending(false), drainScheduled(false), metricsHost(QUrl(url).host()), unreportedBytes(0),
+      unreportedNicBytes(0), contentHash(QCryptographicHash::Sha256), hashedBytes(0),
+      paused(false), headersReported(false), inFlightTracked(false), http1Active(false) {
+    connect(this, &Downloader::downloadFailed, this, [this]() {
+        untrackInFlight();
+        if (registryEntry) {
+            DownloadRegistry::abandoned(downloadUrl, registryEntry);  // Proxy readers following the file give up
+            registryEntry.reset();
+        }
+    });
+}
+
+Downloader::~Downloader() {
+    untrackInFlight();
+    if (registryEntry) {
+        DownloadRegistry::abandoned(downloadUrl, registryEntry);
+    }
+}
+
+QMutex Downloader::inFlightMutex;
+QHash<const Downloader *, Downloader::InFlight> Downloader::inFlightDownloads;
+
+QList<Downloader::InFlight> Downloader::inFlight() {
+    QMutexLocker locker(&inFlightMutex);  // Ensure thread safety
+    return inFlightDownloads.values();
+}
+
+void Downloader::trackInFlight(qint64 bytesTotal) {
+    if (inFlightTracked || bytesTotal <= 0 || !file) {
+        return;
+    }
+    InFlight entry;
+    entry.writePath = file->fileName();
+    entry.finalPath = localPath(downloadUrl, options);
+    entry.totalBytes = bytesTotal;
+    QMutexLocker locker(&inFlightMutex);  // Ensure thread safety
+    inFlightDownloads.insert(this, entry);
+    inFlightTracked = true;
+}
+
+void Downloader::untrackInFlight() {
+    if (!inFlightTracked) {
+        return;
+    }
+    QMutexLocker locker(&inFlightMutex);  // Ensure thread safety
+    inFlightDownloads.remove(this);
+    inFlightTracked = false;
+}
+
+QString Downloader::localPath(const QString &url, const DownloadOptions &options) {
+    return options.targetPath.isEmpty() ? QDir::homePath() + "/qt_downloads/" + QUrl(url).fileName() : options.targetPath;
+}
+
+QString Downloader::journalPath(const QString &url, const DownloadOptions &options) {
+    if (options.journalDir.isEmpty()) {
+        // Same-named files from different URLs, or one URL saved to two targets, each get their own journal
+        QByteArray key = QCryptographicHash::hash((url + "\n" + localPath(url, options)).toUtf8(), QCryptographicHash::Sha1);
+        return QDir::homePath() + "/progress/" + QUrl(url).fileName() + "-" + key.toHex().left(16) + ".progress";
+    }
+    // A private journal directory belongs to a caller that picks a unique target for every URL
+    return options.journalDir + "/" + QFileInfo(localPath(url, options)).fileName() + ".progress";
+}
+
+void Downloader::startDownload() {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    QUrl url(downloadUrl);
+    QString filePath = options.staging ? StagingMover::stagedPath(localPath(downloadUrl, options))
+                                       : localPath(downloadUrl, options);
+    // A previous run received the whole file but stopped before it was moved off scratch
+    bool stagedComplete = options.staging && !file && journalStatus() == "staged";
+    if (stagedComplete && !QFile::exists(filePath)) {
+        filePath = localPath(downloadUrl, options);  // The move went through; only the journal is behind
+    }
+    if (!file) {
+        QDir().mkpath(QFileInfo(filePath).absolutePath());
+        file = new QFile(filePath);
+    }
+
+    // Append so a resumed download keeps the bytes already on disk
+    if (!file->isOpen() && !file->open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Unbuffered)) {
+        emit downloadFailed("Failed to open file for writing.");
+        return;
+    }
+    if (!options.encryptionKey.isEmpty() && !cipher.open(file->fileName(), options.encryptionKey)) {
+        emit downloadFailed("Failed to read the encryption IV file.");
+        return;
+    }
+
+    // Check if progress file already exists before creating it
+    QString progressFilePath = journalPath(downloadUrl, options);
+    QDir().mkpath(QFileInfo(progressFilePath).absolutePath());
+    if (!QFile::exists(progressFilePath)) {
+        createProgressFile();  // Create the progress file if it doesn't exist
+    } else if (!progressFile) {
+        progressFile = new QFile(progressFilePath);  // Resuming an earlier run: keep updating its file
+        qint64 recordedBytes = 0;
+        QString recordedStatus;
+        if (progressFile->open(QIODevice::ReadOnly | QIODevice::Text)) {
+            QTextStream stream(progressFile);
+            while (!stream.atEnd()) {
+                QString line = stream.readLine();
+                if (line.startsWith("Checkpoint:")) {
+                    lastCheckpoint = line.section(":", 1).trimmed().toLongLong();
+                } else if (line.startsWith("Downloaded:")) {
+                    recordedBytes = line.section(":", 1).trimmed().section(" ", 0, 0).toLongLong();
+                } else if (line.startsWith("Status:")) {
+                    recordedStatus = line.section(":", 1).trimmed();
+                }
+            }
+            progressFile->close();
+        }
+
+        // A run that died without pausing leaves "in-progress"; bytes it reported but never got
+        // to disk have to be fetched again
+        DownloadMetrics::resumed(recordedStatus == "in-progress");
+        DownloadMetrics::bytesRefetched(qMax<qint64>(0, recordedBytes - file->size()));
+    }
+
+    downloadedBytes = file->size();
+    lastCheckpoint = qMin(lastCheckpoint, downloadedBytes);
+    durableOffset = downloadedBytes;  // Whatever survived on disk is as durable as it gets
+    syncTimer.start();
+    tailMismatches = 0;
+    resumeOffset = downloadedBytes;
+    contiguousOffset = downloadedBytes;
+
+    // Skip the redirect hops this URL has already taken us through
+    requestUrl = RedirectCache::resolve(url);
+
+    if (stagedComplete) {
+        rehashPrefix();
+        completeDownload();  // Asking the server for more would only get a 416
+        return;
+    }
+    if (downloadedBytes > 0 && HostCache::rangesUnsupported(requestUrl)) {
+        restartFromZero();  // The server would send the whole file anyway
+    }
+    if (downloadedBytes > 0 && options.httpCache && networkManager->cache()
+        && networkManager->cache()->metaData(requestUrl).isValid()) {
+        // A Range request would bypass the cache, and get a 416 if the file is already complete;
+        // a whole fetch is served from the entry, or revalidated against the origin
+        restartFromZero();
+    }
+    if (downloadedBytes > 0 && !options.encryptionKey.isEmpty() && !cipher.covers(downloadedBytes)) {
+        restartFromZero();  // Written without encryption, or its IVs were lost: unreadable either way
+    }
+    rehashPrefix();
+    if (options.shared && options.encryptionKey.isEmpty()) {
+        // The file is written unbuffered and in order, so other readers may follow it as it grows
+        if (!registryEntry) {
+            registryEntry = DownloadRegistry::started(downloadUrl, file->fileName());
+        }
+        registryEntry->available.storeRelease(downloadedBytes);
+    }
+    usedCachedRedirect = requestUrl != url;
+    redirectHops = 0;
+    admit();
+}
+
+void Downloader::admit() {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    if (paused) {
+        return;
+    }
+    int delay = options.staging ? StagingMover::admissionDelayMsecs() : 0;
+    if (delay > 0) {
+        QTimer::singleShot(delay, this, &Downloader::admit);  // Scratch is full: start nothing until the mover makes room
+        return;
+    }
+    if (options.peerCache && downloadedBytes == 0 && PeerCache::instance()) {
+        tryPeers();
+        return;
+    }
+    connectAndSend();
+}
+
+void Downloader::tryPeers() {
+    QList<PeerCache::PeerOffer> offers = PeerCache::instance()->offersFor(downloadUrl);
+    if (!offers.isEmpty()) {
+        fetchFromPeers(offers);
+        return;
+    }
+    if (!PeerCache::instance()->hasOffers()) {
+        // No peer has announced anything lately (every peer re-announces its files periodically),
+        // so nobody would answer: go straight to the origin
+        connectAndSend();
+        return;
+    }
+
+    // Nobody has announced it yet; ask once and give peers a moment to answer
+    static const int peerAnswerWaitMsecs = 200;
+    PeerCache::instance()->query(downloadUrl);
+    QTimer::singleShot(peerAnswerWaitMsecs, this, [this]() {
+        QMutexLocker locker(&mutex);  // Ensure thread safety
+        QList<PeerCache::PeerOffer> offers = PeerCache::instance()->offersFor(downloadUrl);
+        if (offers.isEmpty()) {
+            connectAndSend();
+        } else {
+            fetchFromPeers(offers);
+        }
+    });
+}
+
+void Downloader::fetchFromPeers(const QList<PeerCache::PeerOffer> &offers) {
+    // Everything a peer says about the content is unverified, so the trust anchor is the origin:
+    // a HEAD (headers only, no egress) must carry the representation's SHA-256, and only offers
+    // of exactly that digest and size are used. Origins that publish no digest are fetched directly.
+    QNetworkRequest headRequest(requestUrl);
+    headRequest.setAttribute(QNetworkRequest::RedirectPolicyAttribute, QNetworkRequest::NoLessSafeRedirectPolicy);
+    headRequest.setRawHeader("Want-Repr-Digest", "sha-256=10");
+    QNetworkReply *headReply = networkManager->head(headRequest);
+    connect(headReply, &QNetworkReply::finished, this, [this, headReply, offers]() {
+        QMutexLocker locker(&mutex);  // Ensure thread safety
+        headReply->deleteLater();
+        qint64 originSize = headReply->header(QNetworkRequest::ContentLengthHeader).toLongLong();
+        QByteArray originSha256 = PeerCache::originDigest(headReply);
+
+        QList<PeerCache::PeerOffer> matching;
+        for (const PeerCache::PeerOffer &offer : offers) {
+            if (headReply->error() == QNetworkReply::NoError && !originSha256.isEmpty()
+                && offer.size == originSize && offer.sha256 == originSha256) {
+                matching.append(offer);
+            }
+        }
+        if (matching.isEmpty()) {
+            connectAndSend();
+            return;
+        }
+
+        PeerFetch *fetch = new PeerFetch(matching, this);
+        peerFetch = fetch;
+        connect(fetch, &PeerFetch::pieceReady, this, [this, fetch](const QByteArray &piece) {
+            QMutexLocker locker(&mutex);  // Ensure thread safety
+            if (!writeChunk(piece)) {
+                disconnect(fetch, nullptr, this, nullptr);
+                fetch->abort();
+                fetch->deleteLater();
+                peerFetch = nullptr;
+                return;
+            }
+            DownloadMetrics::peerBytes(piece.size());
+        });
+        connect(fetch, &PeerFetch::finished, this, [this, fetch, matching](bool ok) {
+            QMutexLocker locker(&mutex);  // Ensure thread safety
+            fetch->deleteLater();
+            peerFetch = nullptr;
+            if (ok && downloadedBytes == matching.first().size && contentHash.result() == matching.first().sha256) {
+                completeDownload();
+                return;
+            }
+            restartFromZero();  // Fall back to the origin for the whole file
+            connectAndSend();
+        });
+        fetch->start();
+    });
+}
+
+void Downloader::connectAndSend() {
+    QUrl url(requestUrl);
+
+    // First visit to a plain-HTTP host: race its IPv6 and IPv4 addresses alongside the real request.
+    // The winning socket cannot be handed to QNetworkAccessManager, so waiting for it would only add
+    // a connect; the winner goes into HostCache and later requests to the host connect straight to it
+    // (see sendRequest()). HTTPS is left to Qt, which cannot be pointed at an address without
+    // breaking certificate checks.
+    if (options.happyEyeballs && url.scheme() == "http" && QHostAddress(url.host()).isNull()
+        && HostCache::preferredAddress(url.host()).isNull()) {
+        ConnectionRacer *racer = new ConnectionRacer(this);
+        connect(racer, &ConnectionRacer::finished, racer, &QObject::deleteLater);
+        racer->race(url.host(), url.port(80));
+    }
+
+    sendRequest();
+}
+
+void Downloader::sendRequest() {
+    QUrl url(requestUrl);
+    QNetworkRequest request(url);
+    bool cacheable = options.httpCache && downloadedBytes == 0;  // Range requests bypass the cache
+
+    QHostAddress preferred = HostCache::preferredAddress(url.host());
+    if (!preferred.isNull() && url.scheme() == "http" && !cacheable) {
+        // Connect straight to the address that won the race; the Host header keeps virtual hosting intact.
+        // Not for cacheable fetches: the cache is keyed by the request URL, which must keep the host name.
+        QUrl addressUrl(url);
+        addressUrl.setHost(preferred.toString());
+        request.setUrl(addressUrl);
+        request.setRawHeader("Host", url.port() > 0 ? (url.host() + ":" + QString::number(url.port())).toUtf8()
+                                                    : url.host().toUtf8());
+    }
+
+    resumeOffset = downloadedBytes;  // A retry after a redirect may already have written some bytes
+    rangeStart = downloadedBytes;
+    expectedTail.clear();
+    tailCompared = 0;
+    if (options.verifyTailBytes > 0 && downloadedBytes > 0) {
+        // Ask for the last few KiB again in the same request; drainReply() compares them with the disk
+        file->flush();
+        QFile existing(file->fileName());
+        if (existing.open(QIODevice::ReadOnly)) {
+            qint64 length = qMin(options.verifyTailBytes, downloadedBytes);
+            existing.seek(downloadedBytes - length);
+            expectedTail = existing.read(length);
+            if (!options.encryptionKey.isEmpty()
+                && !cipher.decrypt(downloadedBytes - expectedTail.size(), expectedTail.data(), expectedTail.size())) {
+                expectedTail.clear();  // Nothing to compare against; resume without the check
+            }
+            rangeStart = downloadedBytes - expectedTail.size();
+            DownloadMetrics::bytesRefetched(expectedTail.size());
+        }
+    }
+
+    if (!cacheable) {
+        request.setRawHeader("Range", "bytes=" + QByteArray::number(rangeStart) + "-");
+    } else {
+        // Range requests bypass the cache; a fresh fetch asks for the whole resource so a fresh
+        // cache entry is used as-is and a stale one is revalidated with a conditional request
+        request.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::PreferNetwork);
+    }
+    request.setAttribute(QNetworkRequest::Http2AllowedAttribute, options.http2);
+    request.setAttribute(QNetworkRequest::RedirectPolicyAttribute, QNetworkRequest::ManualRedirectPolicy);
+    request.setPriority(options.priority);
+
+    request.setTransferTimeout(transferTimeoutMsecs);  // A silent server ends in TimeoutError, which is retried
+
+    // With several uplinks configured, plain-HTTP transfers go out through the best-performing one.
+    // Not for cacheable fetches: the bound reply talks to the socket directly and skips the disk cache.
+    flushMetrics();  // Bytes still counted locally belong to the previous request's source
+    sourceAddress = url.scheme() == "http" && !cacheable ? SourceAddressPool::acquire() : QHostAddress();
+    if (!sourceAddress.isNull()) {
+        request.setAttribute(SourceAddressPool::SourceAddressAttribute, sourceAddress.toString());
+    }
+    reply = networkManager->get(request);
+    QNetworkReply *current = reply;
+    connect(reply, &QNetworkReply::metaDataChanged, this, [this, current]() {
+        QMutexLocker locker(&mutex);  // Ensure thread safety
+        if (current == reply && !http1Active && !reply->attribute(QNetworkRequest::Http2WasUsedAttribute).toBool()) {
+            http1Active = true;
+            DownloadMetrics::http1TransferStarted(metricsHost);
+        }
+    });
+
+    DownloadMetrics::transferStarted(metricsHost);
+    transferTimer.start();
+    connectionRate.reset();
+
+    if (options.streaming) {
+        // Bound how far the network may run ahead of the disk so the prefix grows steadily
+        reply->setReadBufferSize(options.readAheadBytes);
+    }
+
+    connect(reply, &QNetworkReply::readyRead, this, &Downloader::onReadyRead);
+    connect(reply, &QNetworkReply::finished, this, &Downloader::onDownloadFinished);
+    connect(reply, &QNetworkReply::downloadProgress, this, &Downloader::onDownloadProgress);
+}
+
+void Downloader::pauseDownload() {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    if (!paused && peerFetch) {
+        paused = true;
+        disconnect(peerFetch, nullptr, this, nullptr);
+        peerFetch->abort();
+        peerFetch->deleteLater();
+        peerFetch = nullptr;
+        // Peer pieces are only vouched for by the whole-file digest check at the end, which a
+        // resume from the origin would skip; start over rather than keep an unverified prefix
+        restartFromZero();
+        writeJournal(0, 0, "paused");
+        if (registryEntry) {
+            DownloadRegistry::abandoned(downloadUrl, registryEntry);  // Readers must not wait on a pause
+            registryEntry.reset();
+        }
+        emit pauseResumeStatusChanged(true);
+        return;
+    }
+    if (!paused && reply) {
+        paused = true;
+        disconnect(reply, &QNetworkReply::readyRead, this, &Downloader::onReadyRead);
+        disconnect(reply, &QNetworkReply::downloadProgress, this, &Downloader::onDownloadProgress);
+        disconnect(reply, &QNetworkReply::finished, this, &Downloader::onDownloadFinished);
+        if (expectedTail.isEmpty() && !drainReply()) {
+            return;  // Keeping it failed the download
+        }
+        file->flush();
+        reply->abort();
+        reportTransfer();
+
+        qint64 totalBytes = resumeOffset + reply->header(QNetworkRequest::ContentLengthHeader).toLongLong();
+        reply->deleteLater();
+        reply = nullptr;
+
+        if (options.durability != DurabilityPolicy::None) {
+            syncData();  // So the paused record can claim everything received
+        }
+        writeJournal(downloadedBytes, totalBytes, "paused");
+        if (registryEntry) {
+            DownloadRegistry::abandoned(downloadUrl, registryEntry);  // Readers must not wait on a pause
+            registryEntry.reset();
+        }
+
+        emit pauseResumeStatusChanged(true);
+    }
+}
+
+void Downloader::resumeDownload() {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    if (paused) {
+        paused = false;
+        startDownload();
+        emit pauseResumeStatusChanged(false);
+    }
+}
+
+void Downloader::onDownloadFinished() {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    reportTransfer();
+    if (isRedirect()) {
+        if (followRedirect()) {
+            return;
+        }
+        file->close();
+        emit downloadFailed("Too many redirects.");
+    } else if (reply->error() != QNetworkReply::NoError && usedCachedRedirect) {
+        // The cached target may have expired (e.g. a signed CDN link); start over from the original URL
+        RedirectCache::invalidate(QUrl(downloadUrl));
+        usedCachedRedirect = false;
+        requestUrl = QUrl(downloadUrl);
+        reply->deleteLater();
+        reply = nullptr;
+        connectAndSend();
+        return;
+    } else if (reply->error() == QNetworkReply::NoError) {
+        if (options.httpCache && resumeOffset == 0) {
+            DownloadMetrics::cacheLookup(reply->attribute(QNetworkRequest::SourceIsFromCacheAttribute).toBool());
+        }
+        if (!drainReply()) {
+            return;  // The tail check failed; the old reply is gone and a new request is under way
+        }
+        completeDownload();
+    } else {
+        if (reply->error() == QNetworkReply::ConnectionRefusedError
+            || reply->error() == QNetworkReply::TimeoutError
+            || reply->error() == QNetworkReply::HostNotFoundError) {
+            HostCache::forget(requestUrl.host());  // Race again next time
+        }
+        file->close();
+        emit downloadFailed(reply->errorString());
+    }
+    reply->deleteLater();
+    reply = nullptr;
+}
+
+void Downloader::completeDownload() {
+    if (options.durability != DurabilityPolicy::None) {
+        syncData();  // Completion is only reported for data that is on disk
+    }
+    file->close();
+    contiguousOffset = downloadedBytes;  // The whole file is now safe to read
+    contentDigest = hashesContent() && hashedBytes == downloadedBytes ? contentHash.result() : QByteArray();
+
+    if (options.staging && file->fileName() != localPath(downloadUrl, options)) {
+        // Reported finished only once it is at its final path; until then the progress file says
+        // "staged", so a restart moves the file instead of resuming the transfer
+        writeJournal(downloadedBytes, downloadedBytes, "staged");
+        StagingMover::migrate(file->fileName(), localPath(downloadUrl, options), this,
+                              [this](const QString &finalPath, const QString &error) {
+            QMutexLocker locker(&mutex);  // Ensure thread safety
+            if (error.isEmpty()) {
+                publishCompletion(finalPath);
+            } else {
+                emit downloadFailed(error);
+            }
+        });
+        return;
+    }
+    publishCompletion(file->fileName());
+}
+
+void Downloader::publishCompletion(const QString &filePath) {
+    // Both would hand out or link the ciphertext as if it were the content the digest describes
+    if (options.dedup && options.encryptionKey.isEmpty() && !contentDigest.isEmpty()) {
+        DedupIndex::submit(filePath, contentDigest, downloadedBytes);
+    }
+    if (options.peerCache && PeerCache::instance() && options.encryptionKey.isEmpty() && !contentDigest.isEmpty()) {
+        PeerCache::instance()->publish(downloadUrl, filePath, contentDigest, downloadedBytes);
+    }
+    if (registryEntry) {
+        DownloadRegistry::completed(downloadUrl, registryEntry, filePath, downloadedBytes);
+        registryEntry.reset();
+    }
+
+    if (progressFile) {
+        writeJournal(downloadedBytes, downloadedBytes, "completed");
+        QFile::remove(progressFile->fileName());
+        delete progressFile;
+        progressFile = nullptr;
+    }
+
+    untrackInFlight();  // At its final path now, so no longer owed any space
+    emit downloadFinished(filePath);
+}
+
+void Downloader::onDownloadProgress(qint64 bytesReceived, qint64 bytesTotal) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    Q_UNUSED(bytesReceived);  // downloadedBytes is kept current by writeChunk()
+    if (isRedirect()) {
+        return;  // Sizes refer to the redirect body, not the file
+    }
+
+    if (bytesTotal > 0) {  // Prevent division by zero
+        bytesTotal += rangeStart;  // The reply only counts the requested range
+        trackInFlight(bytesTotal);
+        emit downloadProgress(downloadedBytes, bytesTotal);  // Emit progress signal
+    } else {
+        emit downloadProgress(downloadedBytes, 1);  // Use a placeholder value if total size isn't available
+    }
+    emit rateUpdated(jobRate.currentRate(), jobRate.smoothedRate(),
+                     bytesTotal > 0 ? jobRate.etaSecs(bytesTotal - downloadedBytes) : -1);
+
+    updateProgressFile(downloadedBytes, bytesTotal);  // Update the progress file with current status
+}
+
+void Downloader::onReadyRead() {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    int delay = qMax(writePacer.delayMsecs(), options.staging ? StagingMover::admissionDelayMsecs() : 0);
+    if (delay == 0) {
+        drainReply();
+        return;
+    }
+
+    // The disk is struggling or scratch is full: leave data in the reply, whose capped buffer then pushes back on the sender
+    reply->setReadBufferSize(options.readAheadBytes);
+    scheduleDrain(delay);
+}
+
+void Downloader::scheduleDrain(int delayMsecs) {
+    if (drainScheduled) {
+        return;
+    }
+    drainScheduled = true;
+    QTimer::singleShot(delayMsecs, this, [this]() {
+        QMutexLocker locker(&mutex);  // Ensure thread safety
+        drainScheduled = false;
+        if (!reply || paused) {
+            return;
+        }
+        int admission = options.staging ? StagingMover::admissionDelayMsecs() : 0;
+        if (admission > 0) {
+            scheduleDrain(admission);  // Still over budget: read nothing at all until the mover catches up
+            return;
+        }
+        drainReply();
+    });
+}
+
+bool Downloader::isRedirect() const {
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    return status == 301 || status == 302 || status == 303 || status == 307 || status == 308;
+}
+
+bool Downloader::followRedirect() {
+    static const int maxRedirectHops = 10;
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    QUrl location = reply->header(QNetworkRequest::LocationHeader).toUrl();
+    if (location.isEmpty() || ++redirectHops > maxRedirectHops) {
+        return false;
+    }
+
+    QUrl target = requestUrl.resolved(location);
+    bool permanent = status == 301 || status == 308;
+    RedirectCache::store(requestUrl, target, permanent, RedirectCache::maxAgeOf(reply));
+
+    requestUrl = target;
+    reply->deleteLater();
+    reply = nullptr;
+    connectAndSend();
+    return true;
+}
+
+bool Downloader::drainReply() {
+    if (isRedirect()) {  // A redirect body is not part of the file
+        reply->readAll();
+        return true;
+    }
+
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (!headersReported && status >= 200 && status < 300) {
+        headersReported = true;
+        emit responseHeaders(reply->rawHeaderPairs());
+    }
+    if (status == 200 && downloadedBytes > 0 && downloadedBytes == resumeOffset) {
+        // The server ignored our Range header and is sending the file from the start
+        HostCache::setAcceptsRanges(requestUrl, false);
+        restartFromZero();
+        expectedTail.clear();
+    }
+
+    // Decrypted HTTPS data has to be copied out of the reply once; make that the only copy.
+    // One reused buffer instead of a fresh QByteArray per readyRead, and an unbuffered file
+    // so the write goes from it straight to the kernel.
+    static const int receiveBufferBytes = 256 * 1024;
+    if (receiveBuffer.size() != receiveBufferBytes) {
+        receiveBuffer.resize(receiveBufferBytes);
+    }
+    while (reply->bytesAvailable() > 0) {
+        qint64 length = reply->read(receiveBuffer.data(), receiveBuffer.size());
+        if (length <= 0) {
+            break;
+        }
+        QByteArray data = QByteArray::fromRawData(receiveBuffer.constData(), int(length));
+        if (!checkTail(data)) {
+            return false;  // backOffToCheckpoint() replaced the reply
+        }
+        if (!writeChunk(data)) {
+            return false;  // failWrite() dropped the reply
+        }
+    }
+    return true;
+}
+
+bool Downloader::checkTail(QByteArray &data) {
+    if (expectedTail.isEmpty()) {
+        return true;
+    }
+
+    // Strip the re-fetched tail off the front of the data, comparing it as it goes
+    qint64 length = qMin<qint64>(data.size(), expectedTail.size() - tailCompared);
+    if (data.left(length) != expectedTail.mid(tailCompared, length)) {
+        backOffToCheckpoint();
+        return false;
+    }
+
+    tailCompared += length;
+    data.remove(0, length);
+    if (tailCompared == expectedTail.size()) {
+        expectedTail.clear();  // Verified; the rest of the response is new data
+    }
+    return true;
+}
+
+void Downloader::backOffToCheckpoint() {
+    // The server's copy or our tail changed since the last run. Bytes up to the last checkpoint
+    // are re-verified by the next request; a second mismatch means starting over.
+    disconnect(reply, nullptr, this, nullptr);
+    reply->abort();
+    reportTransfer();
+    reply->deleteLater();
+    reply = nullptr;
+
+    qint64 target = tailMismatches++ == 0 && lastCheckpoint < rangeStart ? lastCheckpoint : 0;
+    DownloadMetrics::bytesRefetched(downloadedBytes - target);
+    file->flush();
+    file->resize(target);
+    downloadedBytes = target;
+    contiguousOffset = qMin(contiguousOffset, target);
+    if (registryEntry) {
+        registryEntry->available.storeRelease(target);
+    }
+    lastCheckpoint = target;
+    rehashPrefix();
+    sendRequest();
+}
+
+void Downloader::restartFromZero() {
+    file->resize(0);
+    downloadedBytes = 0;
+    resumeOffset = 0;
+    contiguousOffset = 0;
+    contentHash.reset();
+    hashedBytes = 0;
+    if (registryEntry) {
+        registryEntry->available.storeRelease(0);  // Readers past this point are cut off
+    }
+}
+
+void Downloader::rehashPrefix() {
+    // Bring the streaming hash up to the resume offset; this is the only time the file is read back.
+    // After an in-process pause the hash already covers the file, which has not changed since.
+    if (!hashesContent() || hashedBytes == downloadedBytes) {
+        return;
+    }
+    contentHash.reset();
+    hashedBytes = 0;
+    if (downloadedBytes == 0) {
+        return;
+    }
+
+    file->flush();
+    QFile existing(file->fileName());
+    if (existing.open(QIODevice::ReadOnly)) {
+        qint64 remaining = downloadedBytes;
+        while (remaining > 0) {
+            qint64 offset = downloadedBytes - remaining;
+            QByteArray block = existing.read(qMin<qint64>(remaining, 1024 * 1024));
+            if (block.isEmpty()) {
+                break;
+            }
+            if (!options.encryptionKey.isEmpty() && !cipher.decrypt(offset, block.data(), block.size())) {
+                break;  // The hash is of the plaintext; without it, no digest is reported
+            }
+            contentHash.addData(block);
+            hashedBytes += block.size();
+            remaining -= block.size();
+        }
+    }
+}
+
+bool Downloader::writeChunk(const QByteArray &data) {
+    if (data.isEmpty()) {
+        return true;
+    }
+    if (!file->isOpen()) {
+        return false;  // An earlier chunk already failed the download
+    }
+
+    QElapsedTimer writeTimer;
+    writeTimer.start();
+    if (options.encryptionKey.isEmpty()) {
+        if (file->write(data) != data.size()) {
+            failWrite("Cannot write " + file->fileName() + ": " + file->errorString());
+            return false;
+        }
+    } else {
+        if (cipherBuffer.size() < data.size()) {
+            cipherBuffer.resize(data.size());
+        }
+        if (!cipher.encrypt(downloadedBytes, data.constData(), cipherBuffer.data(), data.size())) {
+            failWrite("Cannot encrypt: the IV file could not be written or OpenSSL failed.");
+            return false;
+        }
+        if (file->write(cipherBuffer.constData(), data.size()) != data.size()) {
+            failWrite("Cannot write " + file->fileName() + ": " + file->errorString());
+            return false;
+        }
+    }
+    writePacer.recordWrite(writeTimer.nsecsElapsed() / 1000);
+    if (hashesContent() && hashedBytes == downloadedBytes) {
+        contentHash.addData(data);
+        hashedBytes += data.size();
+    }
+    downloadedBytes += data.size();
+    if (registryEntry) {
+        registryEntry->available.storeRelease(downloadedBytes);  // No lock: this runs for every chunk
+    }
+    jobRate.addBytes(data.size());
+    connectionRate.addBytes(data.size());
+    unreportedBytes += data.size();
+    if (options.pinToNicNode && NumaPlacement::onNicNode()) {
+        unreportedNicBytes += data.size();
+    }
+    if (unreportedBytes >= metricsFlushBytes || !metricsTimer.isValid() || metricsTimer.hasExpired(metricsFlushMsecs)) {
+        flushMetrics();
+    }
+
+    lastWriteNsecs = SyncBatcher::now();
+
+    if (downloadedBytes - lastCheckpoint >= options.checkpointBytes) {
+        file->flush();
+        lastCheckpoint = downloadedBytes;  // Recorded by the next updateProgressFile()
+        barrierPending = options.durability == DurabilityPolicy::Barrier;
+    }
+
+    if (options.streaming) {
+        // Push the chunk to the OS right away so readers tailing the file can see it
+        file->flush();
+        contiguousOffset = downloadedBytes;
+        emit contiguousOffsetChanged(contiguousOffset);
+    }
+    return true;
+}
+
+void Downloader::failWrite(const QString &error) {
+    if (reply) {
+        disconnect(reply, nullptr, this, nullptr);
+        reply->abort();
+        reply->deleteLater();
+        reply = nullptr;
+    }
+    file->close();
+    emit downloadFailed(error);
+}
+
+void Downloader::syncData() {
+    file->flush();
+    SyncBatcher::makeDurable(file->handle(), lastWriteNsecs);
+    durableOffset = downloadedBytes;
+}
+
+void Downloader::flushMetrics() {
+    metricsTimer.start();
+    if (unreportedBytes == 0) {
+        return;
+    }
+    DownloadMetrics::bytesReceived(metricsHost, unreportedBytes);
+    if (!sourceAddress.isNull()) {
+        SourceAddressPool::bytesReceived(sourceAddress, unreportedBytes);
+    }
+    if (options.pinToNicNode) {
+        DownloadMetrics::numaBytes(true, unreportedNicBytes);
+        DownloadMetrics::numaBytes(false, unreportedBytes - unreportedNicBytes);
+    }
+    unreportedBytes = 0;
+    unreportedNicBytes = 0;
+}
+
+void Downloader::reportTransfer() {
+    flushMetrics();
+    bool http2Used = reply->attribute(QNetworkRequest::Http2WasUsedAttribute).toBool();
+    DownloadMetrics::transferFinished(metricsHost, downloadedBytes - resumeOffset,
+                                      transferTimer.elapsed(), http2Used);
+    if (http1Active) {
+        DownloadMetrics::http1TransferFinished(metricsHost);
+        http1Active = false;
+    }
+    if (!sourceAddress.isNull()) {
+        SourceAddressPool::release(sourceAddress);
+        sourceAddress.clear();
+    }
+}
+
+void Downloader::createProgressFile() {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    QString progressFilePath = journalPath(downloadUrl, options);
+    QDir().mkpath(QFileInfo(progressFilePath).absolutePath());
+    progressFile = new QFile(progressFilePath);
+    if (progressFile->open(QIODevice::WriteOnly)) {
+        QTextStream stream(progressFile);
+        stream << "Download URL: " << downloadUrl << "\n";
+        stream << "Target: " << localPath(downloadUrl, options) << "\n";
+        stream << "Downloaded: 0\n";
+        stream << "Status: in-progress\n";  // Set the status as in-progress
+        progressFile->close();
+    }
+}
+
+void Downloader::updateProgressFile(qint64 bytesReceived, qint64 bytesTotal) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    if (options.durability != DurabilityPolicy::None) {
+        // The journal is only rewritten right after a data sync, and never claims more than that sync covered
+        bool periodicDue = options.durability == DurabilityPolicy::Periodic
+                           && syncTimer.hasExpired(options.syncIntervalMsecs);
+        if (!progressFile || (!periodicDue && !barrierPending)) {
+            return;
+        }
+        syncData();
+        syncTimer.restart();
+        barrierPending = false;
+    }
+    writeJournal(bytesReceived, bytesTotal, "in-progress");
+}
+
+void Downloader::writeJournal(qint64 bytesReceived, qint64 bytesTotal, const QString &status) {
+    if (!progressFile) {
+        return;
+    }
+    if (options.durability != DurabilityPolicy::None) {
+        // Never claims more than the last data sync covered
+        qint64 recorded = qMin(bytesReceived, durableOffset);
+        QSaveFile journal(progressFile->fileName());  // Written aside, fsynced and renamed into place on commit
+        if (journal.open(QIODevice::WriteOnly | QIODevice::Text)) {
+            QTextStream stream(&journal);
+            writeProgressLines(stream, recorded, bytesTotal, qMin(lastCheckpoint, recorded), status);
+            stream.flush();
+            journal.commit();
+        }
+        return;
+    }
+
+    if (progressFile->open(QIODevice::WriteOnly | QIODevice::Text)) {
+        QTextStream stream(progressFile);
+        writeProgressLines(stream, bytesReceived, bytesTotal, lastCheckpoint, status);
+        progressFile->close();
+    }
+}
+
+QString Downloader::journalStatus() const {
+    QFile journal(journalPath(downloadUrl, options));
+    if (!journal.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return QString();
+    }
+    QTextStream stream(&journal);
+    while (!stream.atEnd()) {
+        QString line = stream.readLine();
+        if (line.startsWith("Status:")) {
+            return line.section(":", 1).trimmed();
+        }
+    }
+    return QString();
+}
+
+void Downloader::writeProgressLines(QTextStream &stream, qint64 bytesReceived, qint64 bytesTotal, qint64 checkpoint,
+                                    const QString &status) {
+    stream << "Download URL: " << downloadUrl << "\n";
+    stream << "Target: " << localPath(downloadUrl, options) << "\n";  // Where loadUnfinishedDownloads() resumes it
+    stream << "Downloaded: " << bytesReceived << " / " << bytesTotal << "\n";
+    if (options.streaming) {
+        stream << "Contiguous: " << contiguousOffset << "\n";  // Safe read limit for tailing readers
+    }
+    stream << "Checkpoint: " << checkpoint << "\n";  // Where a failed tail check backs off to
+    stream << "Status: " << status << "\n";  // in-progress, paused, staged or completed
+}
+Downloadthread.h
+#ifndef DOWNLOADTHREAD_H
+#define DOWNLOADTHREAD_H
+
+#include <QThread>
+#include <QNetworkAccessManager>
+#include <QString>
+#include "downloader.h"
+
+class DownloadThread : public QThread {
+    Q_OBJECT
+
+public:
+    explicit DownloadThread(QNetworkAccessManager *manager, const QString &url, QObject *parent = nullptr);
+    void run() override;
+    void pauseDownload();
+    void resumeDownload();
+    void setOptions(const DownloadOptions &opts) { options = opts; }
+
+signals:
+    void downloadFinished(const QString &filePath);
+    void downloadFailed(const QString &error);
+    void downloadProgress(qint64 bytesReceived, qint64 bytesTotal);
+    void pauseResumeStatusChanged(bool paused);
+    void contiguousOffsetChanged(qint64 offset);
+    void rateUpdated(double currentBytesPerSec, double smoothedBytesPerSec, qint64 etaSecs);
+
+private:
+    QNetworkAccessManager *networkManager;
+    QString downloadUrl;
+    Downloader *downloader;
+    DownloadOptions options;
+};
+
+#endif // DOWNLOADTHREAD_H
+
+Downloadthread.cpp
+#include "downloadthread.h"
+#include "diskwritepacer.h"
+#include "numaplacement.h"
+#include "looplagmonitor.h"
+
+DownloadThread::DownloadThread(QNetworkAccessManager *manager, const QString &url, QObject *parent)
+    : QThread(parent), networkManager(manager), downloadUrl(url), downloader(nullptr) {}
+
+void DownloadThread::run() {
+    // Applies to this thread only, which is where the downloader does its disk writes
+    DiskWritePacer::setThreadIoPriority(options.ioPriorityClass, options.ioPriorityLevel);
+    if (options.pinToNicNode) {
+        // Before the downloader exists, so its buffers are first touched on the NIC's node
+        NumaPlacement::pinCurrentThread();
+    }
+    if (options.loopLagThresholdMsecs > 0) {
+        LoopLagMonitor::install("download", options.loopLagThresholdMsecs);
+    }
+
+    downloader = new Downloader(networkManager, downloadUrl);
+    downloader->setOptions(options);
+    connect(downloader, &Downloader::downloadFinished, this, &DownloadThread::downloadFinished);
+    connect(downloader, &Downloader::downloadFailed, this, &DownloadThread::downloadFailed);
+    connect(downloader, &Downloader::downloadProgress, this, &DownloadThread::downloadProgress);
+    connect(downloader, &Downloader::pauseResumeStatusChanged, this, &DownloadThread::pauseResumeStatusChanged);
+    connect(downloader, &Downloader::contiguousOffsetChanged, this, &DownloadThread::contiguousOffsetChanged);
+    connect(downloader, &Downloader::rateUpdated, this, &DownloadThread::rateUpdated);
+
+    downloader->startDownload();
+    exec();
+}
+
+void DownloadThread::pauseDownload() {
+    if (downloader) {
+        downloader->pauseDownload();
+    }
+}
+
+void DownloadThread::resumeDownload() {
+    if (downloader) {
+        downloader->resumeDownload();
+    }
+}
+
+Downloadmetrics.h
+#ifndef DOWNLOADMETRICS_H
+#define DOWNLOADMETRICS_H
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+#include "rateestimator.h"
+
+// Process-wide counters shared by all download threads
+class DownloadMetrics {
+public:
+    struct HostStats {
+        int activeTransfers = 0;
+        int peakTransfers = 0;      // Most transfers in flight at once
+        int http2Transfers = 0;
+        int http1Transfers = 0;
+        int activeHttp1Transfers = 0;  // Past their response headers, so each holds a connection
+        int peakHttp1Transfers = 0;
+        qint64 bytes = 0;
+        qint64 busyMsecs = 0;       // Sum of per-transfer durations
+        qint64 connectMsecs = -1;   // Time for the last IPv6/IPv4 race to produce a connection
+        QString connectFamily;
+        RateEstimator rate;
+    };
+
+    struct LoopStats {
+        QVector<qint64> buckets = QVector<qint64>(lagBucketCount, 0);  // Counts per lagBucketLimits range
+        qint64 maxLagMsecs = 0;
+        int stalls = 0;             // Lags past the monitor's threshold
+        QString lastStallStack;
+    };
+
+    static void connectRaced(const QString &host, qint64 msecs, const QString &family);
+    static void cacheLookup(bool hit);
+    static void resumed(bool afterCrash);
+    static void bytesRefetched(qint64 bytes);  // Bytes already received once that must be downloaded again
+    static void peerBytes(qint64 bytes);       // Bytes fetched from LAN peers instead of the origin
+    static void numaBytes(bool onNicNode, qint64 bytes);  // Bytes written from a CPU on / off the NIC's node
+    static void transferStarted(const QString &host);
+    static void http1TransferStarted(const QString &host);   // Headers arrived over HTTP/1.x
+    static void http1TransferFinished(const QString &host);  // One counted by http1TransferStarted()
+    static void bytesReceived(const QString &host, qint64 bytes);
+    static double hostRate(const QString &host);  // Smoothed bytes per second
+    static double globalRate();
+    static void transferFinished(const QString &host, qint64 bytes, qint64 msecs, bool http2Used);
+    static void loopLag(const QString &loop, qint64 msecs);  // One LoopLagMonitor sample
+    static void loopStall(const QString &loop, qint64 msecs, const QString &stack);
+    static QString report();
+
+private:
+    static const int lagBucketCount = 11;
+    static const qint64 lagBucketLimits[lagBucketCount - 1];  // Upper bounds in ms; the last bucket is open
+    static qint64 lagPercentile(const LoopStats &stats, int percent);
+
+    static QMutex mutex;
+    static QHash<QString, HostStats> hosts;
+    static qint64 cacheHits;
+    static qint64 cacheMisses;
+    static qint64 resumes;
+    static qint64 crashResumes;
+    static qint64 refetchedBytes;
+    static RateEstimator totalRate;
+    static qint64 fromPeers;
+    static qint64 nicNodeBytes;
+    static qint64 crossNodeBytes;
+    static QHash<QString, LoopStats> loops;
+};
+
+#endif // DOWNLOADMETRICS_H
+
+Downloadmetrics.cpp
+#include "downloadmetrics.h"
+#include <QMutexLocker>
+#include <QTextStream>
+#include <QtGlobal>
+
+QMutex DownloadMetrics::mutex;
+QHash<QString, DownloadMetrics::HostStats> DownloadMetrics::hosts;
+qint64 DownloadMetrics::cacheHits = 0;
+qint64 DownloadMetrics::cacheMisses = 0;
+qint64 DownloadMetrics::resumes = 0;
+qint64 DownloadMetrics::crashResumes = 0;
+qint64 DownloadMetrics::refetchedBytes = 0;
+RateEstimator DownloadMetrics::totalRate;
+qint64 DownloadMetrics::fromPeers = 0;
+qint64 DownloadMetrics::nicNodeBytes = 0;
+qint64 DownloadMetrics::crossNodeBytes = 0;
+QHash<QString, DownloadMetrics::LoopStats> DownloadMetrics::loops;
+const qint64 DownloadMetrics::lagBucketLimits[lagBucketCount - 1] = {1, 2, 5, 10, 20, 50, 100, 200, 500, 1000};
+
+void DownloadMetrics::connectRaced(const QString &host, qint64 msecs, const QString &family) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    HostStats &stats = hosts[host];
+    stats.connectMsecs = msecs;
+    stats.connectFamily = family;
+}
+
+void DownloadMetrics::cacheLookup(bool hit) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    if (hit) {
+        cacheHits++;  // Fresh entry or a 304 revalidation
+    } else {
+        cacheMisses++;
+    }
+}
+
+void DownloadMetrics::resumed(bool afterCrash) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    resumes++;
+    if (afterCrash) {
+        crashResumes++;
+    }
+}
+
+void DownloadMetrics::bytesRefetched(qint64 bytes) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    refetchedBytes += bytes;
+}
+
+void DownloadMetrics::peerBytes(qint64 bytes) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    fromPeers += bytes;
+}
+
+void DownloadMetrics::loopLag(const QString &loop, qint64 msecs) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    LoopStats &stats = loops[loop];
+    int bucket = 0;
+    while (bucket < lagBucketCount - 1 && msecs >= lagBucketLimits[bucket]) {
+        bucket++;
+    }
+    stats.buckets[bucket]++;
+    stats.maxLagMsecs = qMax(stats.maxLagMsecs, msecs);
+}
+
+void DownloadMetrics::loopStall(const QString &loop, qint64 msecs, const QString &stack) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    LoopStats &stats = loops[loop];
+    stats.stalls++;
+    stats.maxLagMsecs = qMax(stats.maxLagMsecs, msecs);
+    stats.lastStallStack = stack;
+}
+
+qint64 DownloadMetrics::lagPercentile(const LoopStats &stats, int percent) {
+    // Reported as the upper bound of the bucket the percentile falls in
+    qint64 total = 0;
+    for (qint64 count : stats.buckets) {
+        total += count;
+    }
+    qint64 seen = 0;
+    for (int bucket = 0; bucket < lagBucketCount - 1; ++bucket) {
+        seen += stats.buckets[bucket];
+        if (seen * 100 >= total * percent) {
+            return lagBucketLimits[bucket];
+        }
+    }
+    return stats.maxLagMsecs;
+}
+
+void DownloadMetrics::numaBytes(bool onNicNode, qint64 bytes) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    (onNicNode ? nicNodeBytes : crossNodeBytes) += bytes;
+}
+
+void DownloadMetrics::bytesReceived(const QString &host, qint64 bytes) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    hosts[host].rate.addBytes(bytes);
+    totalRate.addBytes(bytes);
+}
+
+double DownloadMetrics::hostRate(const QString &host) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    auto it = hosts.constFind(host);
+    return it == hosts.constEnd() ? 0 : it->rate.smoothedRate();
+}
+
+double DownloadMetrics::globalRate() {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    return totalRate.smoothedRate();
+}
+
+void DownloadMetrics::transferStarted(const QString &host) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    HostStats &stats = hosts[host];
+    stats.activeTransfers++;
+    stats.peakTransfers = qMax(stats.peakTransfers, stats.activeTransfers);
+}
+
+void DownloadMetrics::http1TransferStarted(const QString &host) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    HostStats &stats = hosts[host];
+    stats.activeHttp1Transfers++;
+    stats.peakHttp1Transfers = qMax(stats.peakHttp1Transfers, stats.activeHttp1Transfers);
+}
+
+void DownloadMetrics::http1TransferFinished(const QString &host) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    HostStats &stats = hosts[host];
+    stats.activeHttp1Transfers = qMax(0, stats.activeHttp1Transfers - 1);
+}
+
+void DownloadMetrics::transferFinished(const QString &host, qint64 bytes, qint64 msecs, bool http2Used) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    HostStats &stats = hosts[host];
+    stats.activeTransfers = qMax(0, stats.activeTransfers - 1);
+    stats.bytes += bytes;
+    stats.busyMsecs += msecs;
+    if (http2Used) {
+        stats.http2Transfers++;
+    } else {
+        stats.http1Transfers++;
+    }
+}
+
+QString DownloadMetrics::report() {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    QString text;
+    QTextStream stream(&text);
+    for (auto it = hosts.constBegin(); it != hosts.constEnd(); ++it) {
+        const HostStats &stats = it.value();
+        // An HTTP/1.1 transfer past its headers holds a connection of its own (ones QNetworkAccessManager
+        // queued behind its six per host are not counted until served); HTTP/2 multiplexes onto one
+        double seconds = stats.busyMsecs / 1000.0;
+        double throughput = seconds > 0 ? stats.bytes / seconds / (1024 * 1024) : 0;
+        stream << it.key() << ": " << stats.http2Transfers << " over HTTP/2, "
+               << stats.http1Transfers << " over HTTP/1.1, peak " << stats.peakTransfers
+               << " concurrent, peak " << stats.peakHttp1Transfers << " concurrent over HTTP/1.1, "
+               << QString::number(throughput, 'f', 2) << " MiB/s per transfer";
+        if (stats.connectMsecs >= 0) {
+            stream << ", connected over " << stats.connectFamily << " in " << stats.connectMsecs << " ms";
+        }
+        stream << "\n";
+    }
+
+    qint64 lookups = cacheHits + cacheMisses;
+    if (lookups > 0) {
+        stream << "HTTP cache: " << cacheHits << " hits / " << lookups << " lookups ("
+               << QString::number(100.0 * cacheHits / lookups, 'f', 1) << "%)\n";
+    }
+
+    if (resumes > 0) {
+        stream << "Resume: " << resumes << " resumed, " << crashResumes << " after a crash, "
+               << refetchedBytes << " bytes re-downloaded\n";
+    }
+
+    if (fromPeers > 0) {
+        stream << "Peers: " << fromPeers << " bytes fetched from LAN peers instead of the origin\n";
+    }
+
+    if (nicNodeBytes + crossNodeBytes > 0) {
+        stream << "NUMA: " << nicNodeBytes << " bytes handled on the NIC's node, " << crossNodeBytes
+               << " cross-node (" << QString::number(100.0 * crossNodeBytes / (nicNodeBytes + crossNodeBytes), 'f', 1)
+               << "%)\n";
+    }
+
+    for (auto it = loops.constBegin(); it != loops.constEnd(); ++it) {
+        stream << "Event loop " << it.key() << ": lag p50 <= " << lagPercentile(it.value(), 50) << " ms, p99 <= "
+               << lagPercentile(it.value(), 99) << " ms, max " << it->maxLagMsecs << " ms, " << it->stalls << " stall(s)\n";
+        if (!it->lastStallStack.isEmpty()) {
+            stream << "  last stall:\n" << it->lastStallStack;
+        }
+    }
+    return text;
+}
+Hostcache.h
+#ifndef HOSTCACHE_H
+#define HOSTCACHE_H
+
+#include <QHash>
+#include <QHostAddress>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include <QUrl>
+
+// Per-host connection metadata shared by all download threads, plus the URLs known to
+// ignore Range. That is tracked per URL: one host often serves static files with ranges
+// and generated content without.
+class HostCache {
+public:
+    static QHostAddress preferredAddress(const QString &host);
+    static void setPreferredAddress(const QString &host, const QHostAddress &address);
+    static void forget(const QString &host);
+    static bool rangesUnsupported(const QUrl &url);
+    static void setAcceptsRanges(const QUrl &url, bool accepts);  // Only from a response to a Range request
+
+private:
+    struct Entry {
+        QHostAddress address;   // Address that won the last connection race
+        qint64 expiresAt = 0;   // Milliseconds since epoch
+    };
+
+    static const qint64 addressTtlMsecs = 10 * 60 * 1000;
+
+    static QMutex mutex;
+    static QHash<QString, Entry> entries;
+    static QSet<QString> rangelessUrls;  // Answered a Range request with the whole file
+};
+
+#endif // HOSTCACHE_H
+
+Hostcache.cpp
+#include "hostcache.h"
+#include <QDateTime>
+#include <QMutexLocker>
+
+QMutex HostCache::mutex;
+QHash<QString, HostCache::Entry> HostCache::entries;
+QSet<QString> HostCache::rangelessUrls;
+
+QHostAddress HostCache::preferredAddress(const QString &host) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    auto it = entries.constFind(host);
+    if (it == entries.constEnd() || it->address.isNull() || it->expiresAt < QDateTime::currentMSecsSinceEpoch()) {
+        return QHostAddress();
+    }
+    return it->address;
+}
+
+void HostCache::setPreferredAddress(const QString &host, const QHostAddress &address) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    Entry &entry = entries[host];
+    entry.address = address;
+    entry.expiresAt = QDateTime::currentMSecsSinceEpoch() + addressTtlMsecs;
+}
+
+void HostCache::forget(const QString &host) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    auto it = entries.find(host);
+    if (it != entries.end()) {
+        it->address.clear();  // Only the connection choice is stale
+    }
+}
+
+bool HostCache::rangesUnsupported(const QUrl &url) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    return rangelessUrls.contains(url.toString(QUrl::RemoveFragment));
+}
+
+void HostCache::setAcceptsRanges(const QUrl &url, bool accepts) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    if (accepts) {
+        rangelessUrls.remove(url.toString(QUrl::RemoveFragment));
+    } else {
+        rangelessUrls.insert(url.toString(QUrl::RemoveFragment));
+    }
+}
+
+Connectionracer.h
+#ifndef CONNECTIONRACER_H
+#define CONNECTIONRACER_H
+
+#include <QObject>
+#include <QHostAddress>
+#include <QHostInfo>
+#include <QElapsedTimer>
+#include <QList>
+#include <QTcpSocket>
+#include <QTimer>
+
+// Happy Eyeballs (RFC 8305): connects to a host's addresses with staggered starts,
+// alternating IPv6 and IPv4, and stores the first one to answer in HostCache. Every
+// connection it opens is closed again; only the address is reused, by later requests.
+class ConnectionRacer : public QObject {
+    Q_OBJECT
+
+public:
+    explicit ConnectionRacer(QObject *parent = nullptr);
+    void race(const QString &host, quint16 port);
+
+signals:
+    void finished(const QHostAddress &winner);  // Null address when every attempt failed
+
+private slots:
+    void onLookupFinished(const QHostInfo &info);
+    void startNextAttempt();
+
+private:
+    void finish(const QHostAddress &winner);
+
+    static const int attemptDelayMsecs = 250;   // RFC 8305 Connection Attempt Delay
+    static const int raceTimeoutMsecs = 10000;
+
+    QString hostName;
+    quint16 port;
+    QList<QHostAddress> candidates;             // Interleaved by family, IPv6 first
+    QList<QTcpSocket *> attempts;
+    QTimer attemptTimer;
+    QElapsedTimer elapsed;
+    bool done;
+};
+
+#endif // CONNECTIONRACER_H
+
+Connectionracer.cpp
+#include "connectionracer.h"
+#include "hostcache.h"
+#include "downloadmetrics.h"
+
+ConnectionRacer::ConnectionRacer(QObject *parent)
+    : QObject(parent), port(0), done(false) {
+    attemptTimer.setSingleShot(true);
+    connect(&attemptTimer, &QTimer::timeout, this, &ConnectionRacer::startNextAttempt);
+}
+
+void ConnectionRacer::race(const QString &host, quint16 port) {
+    hostName = host;
+    this->port = port;
+    elapsed.start();
+    QTimer::singleShot(raceTimeoutMsecs, this, [this]() { finish(QHostAddress()); });
+    QHostInfo::lookupHost(host, this, &ConnectionRacer::onLookupFinished);
+}
+
+void ConnectionRacer::onLookupFinished(const QHostInfo &info) {
+    QList<QHostAddress> ipv6, ipv4;
+    for (const QHostAddress &address : info.addresses()) {
+        if (address.protocol() == QAbstractSocket::IPv6Protocol) {
+            ipv6.append(address);
+        } else {
+            ipv4.append(address);
+        }
+    }
+
+    // Alternate families so a broken IPv6 path costs one attempt delay, not one per address
+    while (!ipv6.isEmpty() || !ipv4.isEmpty()) {
+        if (!ipv6.isEmpty()) {
+            candidates.append(ipv6.takeFirst());
+        }
+        if (!ipv4.isEmpty()) {
+            candidates.append(ipv4.takeFirst());
+        }
+    }
+
+    startNextAttempt();
+}
+
+void ConnectionRacer::startNextAttempt() {
+    if (done) {
+        return;
+    }
+    if (candidates.isEmpty()) {
+        if (attempts.isEmpty()) {
+            finish(QHostAddress());  // Nothing left in flight
+        }
+        return;
+    }
+
+    QHostAddress address = candidates.takeFirst();
+    QTcpSocket *socket = new QTcpSocket(this);
+    attempts.append(socket);
+
+    connect(socket, &QTcpSocket::connected, this, [this, address]() { finish(address); });
+    connect(socket, &QAbstractSocket::errorOccurred, this, [this, socket]() {
+        attempts.removeOne(socket);
+        socket->deleteLater();
+        attemptTimer.stop();
+        startNextAttempt();  // A failure starts the next attempt without waiting out the delay
+    });
+
+    socket->connectToHost(address, port);
+    attemptTimer.start(attemptDelayMsecs);
+}
+
+void ConnectionRacer::finish(const QHostAddress &winner) {
+    if (done) {
+        return;
+    }
+    done = true;
+    attemptTimer.stop();
+
+    for (QTcpSocket *socket : attempts) {
+        socket->abort();
+        socket->deleteLater();
+    }
+    attempts.clear();
+
+    if (!winner.isNull()) {
+        HostCache::setPreferredAddress(hostName, winner);
+        DownloadMetrics::connectRaced(hostName, elapsed.elapsed(),
+                                      winner.protocol() == QAbstractSocket::IPv6Protocol ? "IPv6" : "IPv4");
+    }
+    emit finished(winner);
+}
+Redirectcache.h
+#ifndef REDIRECTCACHE_H
+#define REDIRECTCACHE_H
+
+#include <QHash>
+#include <QMutex>
+#include <QNetworkReply>
+#include <QUrl>
+
+// Remembers where URLs redirect to so retries and resumes go straight to the final location.
+// Permanent redirects (301/308) are kept for the life of the process; temporary ones
+// (302/303/307) only as long as their Cache-Control max-age, or five minutes without one.
+class RedirectCache {
+public:
+    static QUrl resolve(const QUrl &url);
+    static void store(const QUrl &from, const QUrl &to, bool permanent, qint64 maxAgeSecs);
+    static void invalidate(const QUrl &url);
+    static qint64 maxAgeOf(QNetworkReply *reply);  // -1 when the reply does not say
+
+private:
+    struct Entry {
+        QUrl target;
+        qint64 expiresAt = 0;  // Milliseconds since epoch, 0 for permanent redirects
+    };
+
+    static const qint64 temporaryTtlSecs = 5 * 60;
+    static const int maxHops = 10;
+
+    static QMutex mutex;
+    static QHash<QUrl, Entry> entries;
+};
+
+#endif // REDIRECTCACHE_H
+
+Redirectcache.cpp
+#include "redirectcache.h"
+#include <QDateTime>
+#include <QMutexLocker>
+#include <QRegularExpression>
+
+QMutex RedirectCache::mutex;
+QHash<QUrl, RedirectCache::Entry> RedirectCache::entries;
+
+QUrl RedirectCache::resolve(const QUrl &url) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QUrl current = url;
+    for (int hop = 0; hop < maxHops; ++hop) {
+        auto it = entries.find(current);
+        if (it == entries.end()) {
+            break;
+        }
+        if (it->expiresAt != 0 && it->expiresAt < now) {
+            entries.erase(it);
+            break;
+        }
+        current = it->target;
+    }
+    return current;
+}
+
+void RedirectCache::store(const QUrl &from, const QUrl &to, bool permanent, qint64 maxAgeSecs) {
+    if (!permanent && maxAgeSecs == 0) {
+        return;  // The server asked us not to reuse it
+    }
+
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    Entry &entry = entries[from];
+    entry.target = to;
+    if (permanent) {
+        entry.expiresAt = 0;
+    } else {
+        qint64 ttl = maxAgeSecs > 0 ? maxAgeSecs : temporaryTtlSecs;
+        entry.expiresAt = QDateTime::currentMSecsSinceEpoch() + ttl * 1000;
+    }
+}
+
+void RedirectCache::invalidate(const QUrl &url) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    QUrl current = url;
+    for (int hop = 0; hop < maxHops; ++hop) {
+        auto it = entries.find(current);
+        if (it == entries.end()) {
+            break;
+        }
+        current = it->target;
+        entries.erase(it);
+    }
+}
+
+qint64 RedirectCache::maxAgeOf(QNetworkReply *reply) {
+    QString cacheControl = QString::fromLatin1(reply->rawHeader("Cache-Control"));
+    if (cacheControl.contains("no-store") || cacheControl.contains("no-cache")) {
+        return 0;
+    }
+
+    QRegularExpressionMatch match = QRegularExpression("max-age=(\\d+)").match(cacheControl);
+    return match.hasMatch() ? match.captured(1).toLongLong() : -1;
+}
+Preflightprober.h
+#ifndef PREFLIGHTPROBER_H
+#define PREFLIGHTPROBER_H
+
+#include <QObject>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QHash>
+#include <QList>
+#include <QStringList>
+#include <QUrl>
+
+// Probes a batch of URLs concurrently before it is started: HEAD first, then a 0-0 range GET
+// for servers that reject HEAD. Final URLs, and range support where a range GET showed it,
+// go into RedirectCache and HostCache so the downloads that follow use them.
+class PreflightProber : public QObject {
+    Q_OBJECT
+
+public:
+    struct ProbeResult {
+        QString url;
+        bool ok = false;
+        qint64 size = -1;           // -1 when the server did not say
+        bool acceptsRanges = false;
+        QString error;
+    };
+
+    struct HostCapabilities {
+        int probed = 0;
+        int failed = 0;
+        bool acceptsRanges = false; // Every successful probe advertised byte ranges
+    };
+
+    explicit PreflightProber(QNetworkAccessManager *manager, QObject *parent = nullptr);
+    void setPerHostLimit(int limit) { perHostLimit = limit; }
+    void probe(const QStringList &urls);
+
+    const QList<ProbeResult> &results() const { return probeResults; }
+    QHash<QString, HostCapabilities> hostCapabilities() const;
+    qint64 totalBytes() const;      // Sum over URLs with a known size
+    QStringList failedUrls() const;
+    QString summary() const;
+
+signals:
+    void finished();
+
+private:
+    void startNext(const QString &host);
+    void sendProbe(int index, bool rangeGet);
+    void onProbeFinished(QNetworkReply *probeReply, int index, bool rangeGet);
+
+    QNetworkAccessManager *networkManager;
+    int perHostLimit;
+    int pending;
+    QList<ProbeResult> probeResults;
+    QHash<QString, QList<int>> queued;  // Result indexes waiting for a slot, per host
+    QHash<QString, int> active;
+};
+
+#endif // PREFLIGHTPROBER_H
+
+Preflightprober.cpp
+#include "preflightprober.h"
+#include "hostcache.h"
+#include "redirectcache.h"
+#include <QNetworkRequest>
+#include <QTextStream>
+
+PreflightProber::PreflightProber(QNetworkAccessManager *manager, QObject *parent)
+    : QObject(parent), networkManager(manager), perHostLimit(4), pending(0) {}
+
+void PreflightProber::probe(const QStringList &urls) {
+    for (const QString &url : urls) {
+        ProbeResult result;
+        result.url = url;
+        probeResults.append(result);
+        queued[QUrl(url).host()].append(probeResults.size() - 1);
+    }
+
+    pending = probeResults.size();
+    if (pending == 0) {
+        emit finished();
+        return;
+    }
+
+    const QStringList hosts = queued.keys();
+    for (const QString &host : hosts) {
+        startNext(host);
+    }
+}
+
+void PreflightProber::startNext(const QString &host) {
+    QList<int> &waiting = queued[host];
+    while (!waiting.isEmpty() && active.value(host) < perHostLimit) {
+        active[host]++;
+        sendProbe(waiting.takeFirst(), false);
+    }
+}
+
+void PreflightProber::sendProbe(int index, bool rangeGet) {
+    QNetworkRequest request(RedirectCache::resolve(QUrl(probeResults[index].url)));
+    request.setAttribute(QNetworkRequest::RedirectPolicyAttribute, QNetworkRequest::NoLessSafeRedirectPolicy);
+
+    QNetworkReply *probeReply;
+    if (rangeGet) {
+        request.setRawHeader("Range", "bytes=0-0");
+        probeReply = networkManager->get(request);
+        // Headers are all we need; a server that ignores the range must not send us the file
+        connect(probeReply, &QNetworkReply::metaDataChanged, probeReply, [probeReply]() {
+            if (probeReply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 200) {
+                probeReply->setProperty("headersOnly", true);
+                probeReply->abort();
+            }
+        });
+    } else {
+        probeReply = networkManager->head(request);
+    }
+
+    connect(probeReply, &QNetworkReply::finished, this, [this, probeReply, index, rangeGet]() {
+        onProbeFinished(probeReply, index, rangeGet);
+    });
+}
+
+void PreflightProber::onProbeFinished(QNetworkReply *probeReply, int index, bool rangeGet) {
+    probeReply->deleteLater();
+    ProbeResult &result = probeResults[index];
+    QUrl original(result.url);
+    int status = probeReply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    bool aborted = probeReply->property("headersOnly").toBool();
+
+    if ((probeReply->error() != QNetworkReply::NoError && !aborted) || status >= 400) {
+        bool unreachable = probeReply->error() == QNetworkReply::HostNotFoundError
+                           || probeReply->error() == QNetworkReply::ConnectionRefusedError;
+        if (!rangeGet && !unreachable) {
+            sendProbe(index, true);  // Some servers reject or mishandle HEAD
+            return;
+        }
+        result.ok = false;
+        result.error = status >= 400 ? QString("HTTP %1").arg(status) : probeReply->errorString();
+    } else {
+        result.ok = true;
+        QByteArray contentRange = probeReply->rawHeader("Content-Range");  // "bytes 0-0/12345"
+        if (status == 206 && contentRange.contains('/')) {
+            result.acceptsRanges = true;
+            QByteArray total = contentRange.mid(contentRange.lastIndexOf('/') + 1);
+            result.size = total == "*" ? -1 : total.toLongLong();
+        } else {
+            result.acceptsRanges = probeReply->rawHeader("Accept-Ranges").trimmed() == "bytes";
+            QVariant length = probeReply->header(QNetworkRequest::ContentLengthHeader);
+            result.size = length.isValid() ? length.toLongLong() : -1;
+        }
+
+        QUrl finalUrl = probeReply->url();
+        if (finalUrl != RedirectCache::resolve(original)) {
+            RedirectCache::store(original, finalUrl, false, -1);  // Hop codes are unknown, so treat as temporary
+        }
+        // A HEAD without Accept-Ranges proves nothing; only the answer to an actual Range request does
+        if (rangeGet) {
+            HostCache::setAcceptsRanges(finalUrl, status == 206);
+        }
+    }
+
+    QString host = original.host();
+    active[host]--;
+    startNext(host);
+
+    if (--pending == 0) {
+        emit finished();
+    }
+}
+
+QHash<QString, PreflightProber::HostCapabilities> PreflightProber::hostCapabilities() const {
+    QHash<QString, HostCapabilities> hosts;
+    QHash<QString, bool> anyRanges;
+    for (const ProbeResult &result : probeResults) {
+        QString host = QUrl(result.url).host();
+        HostCapabilities &caps = hosts[host];
+        caps.probed++;
+        if (!result.ok) {
+            caps.failed++;
+            continue;
+        }
+        caps.acceptsRanges = anyRanges.contains(host) ? caps.acceptsRanges && result.acceptsRanges
+                                                      : result.acceptsRanges;
+        anyRanges[host] = true;
+    }
+    return hosts;
+}
+
+qint64 PreflightProber::totalBytes() const {
+    qint64 total = 0;
+    for (const ProbeResult &result : probeResults) {
+        if (result.ok && result.size > 0) {
+            total += result.size;
+        }
+    }
+    return total;
+}
+
+QStringList PreflightProber::failedUrls() const {
+    QStringList failed;
+    for (const ProbeResult &result : probeResults) {
+        if (!result.ok) {
+            failed.append(result.url + " (" + result.error + ")");
+        }
+    }
+    return failed;
+}
+
+QString PreflightProber::summary() const {
+    QString text;
+    QTextStream stream(&text);
+    stream << probeResults.size() << " URLs, " << failedUrls().size() << " failed, "
+           << QString::number(totalBytes() / (1024.0 * 1024.0), 'f', 1) << " MiB total\n";
+    const QHash<QString, HostCapabilities> hosts = hostCapabilities();
+    for (auto it = hosts.constBegin(); it != hosts.constEnd(); ++it) {
+        stream << it.key() << ": " << it->probed << " probed, " << it->failed << " failed, "
+               << (it->acceptsRanges ? "ranges" : "no ranges") << "\n";
+    }
+    for (const QString &failure : failedUrls()) {
+        stream << "failed: " << failure << "\n";
+    }
+    return text;
+}
+Dedupindex.h
+#ifndef DEDUPINDEX_H
+#define DEDUPINDEX_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+
+// Content-addressed index of completed downloads, kept in ~/qt_downloads/.dedup-index.
+// A completed file whose SHA-256 is already indexed is replaced, in the background, by a
+// reflink of the earlier copy, or a hardlink where the filesystem cannot share extents.
+// Only downloads completed with --dedup are indexed. The file is appended to and compacted
+// on load, and again whenever superseded lines outnumber live ones.
+class DedupIndex {
+public:
+    static void submit(const QString &filePath, const QByteArray &sha256, qint64 size);
+
+private:
+    struct Entry {
+        QString path;
+        qint64 size = 0;
+    };
+
+    static void process(const QString &filePath, const QByteArray &sha256, qint64 size);
+    static void load();
+    static void append(const QByteArray &sha256, const Entry &entry);
+    static void rewrite();  // One line per live entry, replacing the file atomically
+    static bool replaceWithLink(const QString &original, const QString &duplicate);
+    static QString indexPath();
+
+    static const int compactSlackLines = 64;  // Stale lines tolerated before any rewrite
+
+    static QMutex mutex;
+    static QHash<QByteArray, Entry> entries;  // Keyed by raw SHA-256
+    static int fileLines;                     // In the index file, live or superseded
+    static bool loaded;
+};
+
+#endif // DEDUPINDEX_H
+
+Dedupindex.cpp
+#include "dedupindex.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QTextStream>
+#include <QThreadPool>
+#include <functional>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+QMutex DedupIndex::mutex;
+QHash<QByteArray, DedupIndex::Entry> DedupIndex::entries;
+int DedupIndex::fileLines = 0;
+bool DedupIndex::loaded = false;
+
+namespace {
+class DedupTask : public QRunnable {
+public:
+    DedupTask(std::function<void()> work) : work(std::move(work)) {}
+    void run() override { work(); }
+
+private:
+    std::function<void()> work;
+};
+}
+
+void DedupIndex::submit(const QString &filePath, const QByteArray &sha256, qint64 size) {
+    // Off the download thread: loading the index and linking touch the disk
+    QThreadPool::globalInstance()->start(new DedupTask([=]() { process(filePath, sha256, size); }));
+}
+
+void DedupIndex::process(const QString &filePath, const QByteArray &sha256, qint64 size) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    load();
+
+    QString canonical = QFileInfo(filePath).absoluteFilePath();
+    auto it = entries.find(sha256);
+    if (it != entries.end() && it->path != canonical) {
+        QFileInfo original(it->path);
+        if (original.exists() && original.size() == size && size > 0) {
+            replaceWithLink(it->path, canonical);
+            return;
+        }
+        entries.erase(it);  // The indexed copy is gone or changed; this file takes its place
+    }
+
+    Entry entry;
+    entry.path = canonical;
+    entry.size = size;
+    entries.insert(sha256, entry);
+    append(sha256, entry);
+}
+
+void DedupIndex::load() {
+    if (loaded) {
+        return;
+    }
+    loaded = true;
+
+    QFile index(indexPath());
+    if (!index.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return;
+    }
+    QTextStream stream(&index);
+    while (!stream.atEnd()) {
+        // "<sha256 hex> <size> <path>"; later lines win
+        QString line = stream.readLine();
+        QByteArray sha256 = QByteArray::fromHex(line.section(' ', 0, 0).toLatin1());
+        Entry entry;
+        entry.size = line.section(' ', 1, 1).toLongLong();
+        entry.path = line.section(' ', 2);
+        if (sha256.size() == 32 && !entry.path.isEmpty()) {
+            entries.insert(sha256, entry);
+        }
+        fileLines++;
+    }
+    index.close();
+
+    // Files deleted or changed since they were indexed can never be linked to again
+    for (auto it = entries.begin(); it != entries.end();) {
+        QFileInfo file(it->path);
+        it = file.exists() && file.size() == it->size ? it + 1 : entries.erase(it);
+    }
+    if (fileLines > entries.size()) {
+        rewrite();
+    }
+}
+
+void DedupIndex::rewrite() {
+    QSaveFile index(indexPath());
+    if (!index.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        return;
+    }
+    QTextStream stream(&index);
+    for (auto it = entries.constBegin(); it != entries.constEnd(); ++it) {
+        stream << it.key().toHex() << " " << it->size << " " << it->path << "\n";
+    }
+    stream.flush();
+    if (index.commit()) {
+        fileLines = entries.size();
+    }
+}
+
+void DedupIndex::append(const QByteArray &sha256, const Entry &entry) {
+    QFile index(indexPath());
+    if (index.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+        QTextStream stream(&index);
+        stream << sha256.toHex() << " " << entry.size << " " << entry.path << "\n";
+        fileLines++;
+    }
+    if (fileLines > 2 * entries.size() + compactSlackLines) {
+        rewrite();
+    }
+}
+
+bool DedupIndex::replaceWithLink(const QString &original, const QString &duplicate) {
+    QByteArray source = QFile::encodeName(original);
+    QByteArray target = QFile::encodeName(duplicate);
+    QByteArray temporary = target + ".dedup";
+
+    // Reflink first: the copies share extents but stay independent files
+    bool linked = false;
+    int sourceFd = ::open(source.constData(), O_RDONLY | O_CLOEXEC);
+    if (sourceFd >= 0) {
+        int tempFd = ::open(temporary.constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (tempFd >= 0) {
+            linked = ::ioctl(tempFd, FICLONE, sourceFd) == 0;
+            ::close(tempFd);
+        }
+        ::close(sourceFd);
+    }
+    if (!linked) {
+        ::unlink(temporary.constData());
+        linked = ::link(source.constData(), temporary.constData()) == 0;
+    }
+
+    // rename() swaps the duplicate out atomically, so readers never see a missing file
+    if (!linked || ::rename(temporary.constData(), target.constData()) != 0) {
+        ::unlink(temporary.constData());
+        return false;
+    }
+    return true;
+}
+
+QString DedupIndex::indexPath() {
+    return QDir::homePath() + "/qt_downloads/.dedup-index";
+}
+Downloadregistry.h
+#ifndef DOWNLOADREGISTRY_H
+#define DOWNLOADREGISTRY_H
+
+#include <QAtomicInteger>
+#include <QHash>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QString>
+
+// URLs this instance already has on disk in plain form, so the proxy can serve them without
+// a second fetch: downloads in flight, whose files grow in order, and completed ones, which
+// are remembered across runs in ~/qt_downloads/.completed-index. Only completions of shared
+// downloads are recorded; the index is compacted on load and whenever stale lines dominate.
+class DownloadRegistry {
+public:
+    enum State { Running, Completed, Abandoned };
+
+    struct Progress {
+        QString path;
+        QAtomicInteger<qint64> available;  // Bytes from the start of the file that can be read
+        QAtomicInt state;                  // A State
+    };
+
+    // For downloaders; the returned Progress is then updated without taking a lock
+    static QSharedPointer<Progress> started(const QString &url, const QString &path);
+    static void completed(const QString &url, const QSharedPointer<Progress> &progress, const QString &path, qint64 size);
+    static void abandoned(const QString &url, const QSharedPointer<Progress> &progress);
+
+    // In-flight or completed download of url, or null
+    static QSharedPointer<Progress> lookup(const QString &url);
+
+private:
+    struct Entry {
+        QString path;
+        qint64 size = 0;
+    };
+
+    static QString key(const QString &url);
+    static void load();
+    static void rewrite();  // One line per entry in done, replacing the file atomically
+    static QString indexPath();
+
+    static const int compactSlackLines = 64;  // Stale lines tolerated before any rewrite
+
+    static QMutex mutex;
+    static QHash<QString, QSharedPointer<Progress>> running;
+    static QHash<QString, Entry> done;
+    static int fileLines;  // In the index file, live or superseded
+    static bool loaded;
+};
+
+#endif // DOWNLOADREGISTRY_H
+
+Downloadregistry.cpp
+#include "downloadregistry.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QTextStream>
+#include <QUrl>
+
+QMutex DownloadRegistry::mutex;
+QHash<QString, QSharedPointer<DownloadRegistry::Progress>> DownloadRegistry::running;
+QHash<QString, DownloadRegistry::Entry> DownloadRegistry::done;
+int DownloadRegistry::fileLines = 0;
+bool DownloadRegistry::loaded = false;
+
+QString DownloadRegistry::key(const QString &url) {
+    return QUrl(url).toString(QUrl::RemoveFragment | QUrl::FullyEncoded);
+}
+
+QSharedPointer<DownloadRegistry::Progress> DownloadRegistry::started(const QString &url, const QString &path) {
+    QSharedPointer<Progress> progress(new Progress);
+    progress->path = path;
+    progress->state.storeRelease(Running);
+
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    running.insert(key(url), progress);
+    return progress;
+}
+
+void DownloadRegistry::completed(const QString &url, const QSharedPointer<Progress> &progress, const QString &path,
+                                 qint64 size) {
+    progress->available.storeRelease(size);
+    progress->state.storeRelease(Completed);  // Readers keep the handle they opened, wherever the file went
+
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    load();
+    if (running.value(key(url)) == progress) {
+        running.remove(key(url));
+    }
+    Entry entry;
+    entry.path = QFileInfo(path).absoluteFilePath();
+    entry.size = size;
+    done.insert(key(url), entry);
+
+    QFile index(indexPath());
+    if (index.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+        QTextStream stream(&index);
+        stream << entry.size << " " << key(url) << " " << entry.path << "\n";
+        fileLines++;
+    }
+    if (fileLines > 2 * done.size() + compactSlackLines) {
+        rewrite();  // Mostly re-downloads and entries lookup() found stale
+    }
+}
+
+void DownloadRegistry::abandoned(const QString &url, const QSharedPointer<Progress> &progress) {
+    progress->state.storeRelease(Abandoned);
+
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    if (running.value(key(url)) == progress) {
+        running.remove(key(url));
+    }
+}
+
+QSharedPointer<DownloadRegistry::Progress> DownloadRegistry::lookup(const QString &url) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    if (running.contains(key(url))) {
+        return running.value(key(url));
+    }
+
+    load();
+    auto it = done.find(key(url));
+    if (it == done.end()) {
+        return QSharedPointer<Progress>();
+    }
+    QFileInfo info(it->path);
+    if (!info.exists() || info.size() != it->size) {
+        done.erase(it);  // Deleted or changed since; it is not the download any more
+        return QSharedPointer<Progress>();
+    }
+    QSharedPointer<Progress> progress(new Progress);
+    progress->path = it->path;
+    progress->available.storeRelease(it->size);
+    progress->state.storeRelease(Completed);
+    return progress;
+}
+
+void DownloadRegistry::load() {
+    if (loaded) {
+        return;
+    }
+    loaded = true;
+
+    QFile index(indexPath());
+    if (!index.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return;
+    }
+    QTextStream stream(&index);
+    while (!stream.atEnd()) {
+        // "<size> <url> <path>"; URLs are encoded and hold no spaces; later lines win
+        QString line = stream.readLine();
+        Entry entry;
+        entry.size = line.section(' ', 0, 0).toLongLong();
+        entry.path = line.section(' ', 2);
+        QString url = line.section(' ', 1, 1);
+        if (!url.isEmpty() && !entry.path.isEmpty()) {
+            done.insert(url, entry);
+        }
+        fileLines++;
+    }
+    index.close();
+    if (fileLines > done.size()) {
+        rewrite();  // Drops lines later ones superseded; lookup() checks the files themselves
+    }
+}
+
+void DownloadRegistry::rewrite() {
+    QSaveFile index(indexPath());
+    if (!index.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        return;
+    }
+    QTextStream stream(&index);
+    for (auto it = done.constBegin(); it != done.constEnd(); ++it) {
+        stream << it->size << " " << it.key() << " " << it->path << "\n";
+    }
+    stream.flush();
+    if (index.commit()) {
+        fileLines = done.size();
+    }
+}
+
+QString DownloadRegistry::indexPath() {
+    return QDir::homePath() + "/qt_downloads/.completed-index";
+}
+
+Syncbatcher.h
+#ifndef SYNCBATCHER_H
+#define SYNCBATCHER_H
+
+#include <QHash>
+#include <QMutex>
+#include <QtGlobal>
+
+// Shares data syncs between downloads. One syncfs() flushes every dirty file on one volume, so
+// a download whose last write is older than the start of a completed sync of its volume has
+// nothing left to flush and skips its own. Volumes are told apart by st_dev and batched
+// separately, so a sync of scratch never stands in for one of the bulk tier.
+class SyncBatcher {
+public:
+    static qint64 now();  // Monotonic nanoseconds, for write stamps
+    static void makeDurable(int fd, qint64 lastWriteNsecs);
+
+private:
+    struct Volume {
+        QMutex mutex;                    // Held while this volume syncs
+        qint64 lastSyncStartedAt = 0;    // Start time of its last successful sync
+    };
+
+    static QMutex mutex;                 // Guards volumes
+    static QHash<quint64, Volume *> volumes;  // By st_dev; never freed, there are only a few
+};
+
+#endif // SYNCBATCHER_H
+
+Syncbatcher.cpp
+#include "syncbatcher.h"
+#include <QMutexLocker>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+QMutex SyncBatcher::mutex;
+QHash<quint64, SyncBatcher::Volume *> SyncBatcher::volumes;
+
+qint64 SyncBatcher::now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void SyncBatcher::makeDurable(int fd, qint64 lastWriteNsecs) {
+    struct stat info;
+    if (::fstat(fd, &info) != 0) {
+        ::fdatasync(fd);  // Volume unknown: just this file
+        return;
+    }
+    Volume *volume;
+    {
+        QMutexLocker locker(&mutex);  // Ensure thread safety
+        volume = volumes.value(quint64(info.st_dev));
+        if (!volume) {
+            volume = new Volume;
+            volumes.insert(quint64(info.st_dev), volume);
+        }
+    }
+
+    // Callers on the same volume queue here while a sync runs; most then find it already covered their writes
+    QMutexLocker locker(&volume->mutex);  // Ensure thread safety
+    if (volume->lastSyncStartedAt > lastWriteNsecs) {
+        return;
+    }
+
+    qint64 startedAt = now();
+    if (::syncfs(fd) == 0) {
+        volume->lastSyncStartedAt = startedAt;
+    } else {
+        ::fdatasync(fd);  // Just this file, and no credit for anyone else
+    }
+}
+Indexcrawler.h
+#ifndef INDEXCRAWLER_H
+#define INDEXCRAWLER_H
+
+#include <QObject>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QDateTime>
+#include <QList>
+#include <QRegularExpression>
+#include <QSet>
+#include <QUrl>
+
+// Walks a tree of HTTP autoindex pages (Apache, nginx and lookalikes). Listings are parsed
+// while they stream in, and each file is reported as soon as its line arrives.
+class IndexCrawler : public QObject {
+    Q_OBJECT
+
+public:
+    explicit IndexCrawler(QNetworkAccessManager *manager, QObject *parent = nullptr);
+    void setMaxDepth(int depth) { maxDepth = depth; }
+    void setFilters(const QString &accept, const QString &reject);
+    void setLocalRoot(const QString &path) { localRoot = path; }  // Mirror location, for skipping unchanged files
+    void crawl(const QUrl &rootUrl);
+    QString summary() const;
+
+signals:
+    void fileDiscovered(const QUrl &url, const QString &relativePath);
+    void finished();
+
+private:
+    struct Listing {
+        QUrl url;
+        int depth = 0;
+    };
+
+    void startNext();
+    void parseLines(QNetworkReply *listingReply, bool final);
+    void handleEntry(const Listing &listing, const QString &href, const QString &rest);
+    bool isUnchanged(const QString &relativePath, qint64 size, const QDateTime &modified) const;
+    bool isSafeRelativePath(const QString &relativePath) const;  // No "..", backslash or NUL; stays under localRoot
+
+    static const int maxConcurrentListings = 4;
+
+    QNetworkAccessManager *networkManager;
+    QUrl root;
+    QString localRoot;
+    int maxDepth;
+    QRegularExpression acceptFilter;
+    QRegularExpression rejectFilter;
+    QList<Listing> pendingListings;
+    QSet<QUrl> seen;
+    int activeListings;
+    int discovered;
+    int skipped;
+    int failedListings;
+};
+
+#endif // INDEXCRAWLER_H
+
+Indexcrawler.cpp
+#include "indexcrawler.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QLocale>
+#include <QTextStream>
+
+IndexCrawler::IndexCrawler(QNetworkAccessManager *manager, QObject *parent)
+    : QObject(parent), networkManager(manager), maxDepth(5), activeListings(0), discovered(0), skipped(0),
+      failedListings(0) {}
+
+void IndexCrawler::setFilters(const QString &accept, const QString &reject) {
+    acceptFilter = QRegularExpression(accept);
+    rejectFilter = QRegularExpression(reject);
+}
+
+void IndexCrawler::crawl(const QUrl &rootUrl) {
+    root = rootUrl;
+    Listing listing;
+    listing.url = rootUrl;
+    pendingListings.append(listing);
+    seen.insert(rootUrl);
+    startNext();
+}
+
+void IndexCrawler::startNext() {
+    while (!pendingListings.isEmpty() && activeListings < maxConcurrentListings) {
+        Listing listing = pendingListings.takeFirst();
+        activeListings++;
+
+        QNetworkRequest request(listing.url);
+        request.setAttribute(QNetworkRequest::RedirectPolicyAttribute, QNetworkRequest::NoLessSafeRedirectPolicy);
+        QNetworkReply *listingReply = networkManager->get(request);
+        listingReply->setProperty("depth", listing.depth);
+
+        connect(listingReply, &QNetworkReply::readyRead, this, [this, listingReply]() {
+            parseLines(listingReply, false);
+        });
+        connect(listingReply, &QNetworkReply::finished, this, [this, listingReply]() {
+            if (listingReply->error() == QNetworkReply::NoError) {
+                parseLines(listingReply, true);
+            } else {
+                failedListings++;
+            }
+            listingReply->deleteLater();
+            activeListings--;
+            startNext();
+        });
+    }
+
+    if (pendingListings.isEmpty() && activeListings == 0) {
+        emit finished();
+    }
+}
+
+void IndexCrawler::parseLines(QNetworkReply *listingReply, bool final) {
+    // Index pages put one entry per line; hold back a trailing partial line until the rest arrives
+    QByteArray buffer = listingReply->property("pending").toByteArray() + listingReply->readAll();
+    int end = final ? buffer.size() : buffer.lastIndexOf('\n') + 1;
+    listingReply->setProperty("pending", buffer.mid(end));
+
+    Listing listing;
+    listing.url = listingReply->url();
+    listing.depth = listingReply->property("depth").toInt();
+
+    static const QRegularExpression anchor("<a\\s[^>]*href=\"([^\"]+)\"[^>]*>.*?</a>(.*?)(?=<a\\s|$)",
+                                           QRegularExpression::CaseInsensitiveOption);
+    const QList<QByteArray> lines = buffer.left(end).split('\n');
+    for (const QByteArray &line : lines) {
+        QRegularExpressionMatchIterator it = anchor.globalMatch(QString::fromUtf8(line));
+        while (it.hasNext()) {
+            QRegularExpressionMatch match = it.next();
+            handleEntry(listing, match.captured(1), match.captured(2));
+        }
+    }
+}
+
+void IndexCrawler::handleEntry(const Listing &listing, const QString &href, const QString &rest) {
+    // Sort links, parent links and anything outside the root are not part of the tree
+    if (href.startsWith('?') || href.startsWith('#') || href.startsWith("mailto:")) {
+        return;
+    }
+    QUrl url = listing.url.resolved(QUrl(href));
+    url.setQuery(QString());
+    url.setFragment(QString());
+    if (url.host() != root.host() || !url.path().startsWith(root.path()) || url.path() == listing.url.path()
+        || seen.contains(url)) {
+        return;
+    }
+    seen.insert(url);
+
+    // path() is already decoded; decoding it again would turn "..%2F" into a real "../"
+    QString relativePath = url.path().mid(root.path().size());
+    if (!isSafeRelativePath(relativePath)) {
+        return;  // Would land outside the mirror
+    }
+    if (url.path().endsWith('/')) {
+        if (listing.depth < maxDepth) {
+            Listing child;
+            child.url = url;
+            child.depth = listing.depth + 1;
+            pendingListings.append(child);
+            startNext();
+        }
+        return;
+    }
+
+    if ((!acceptFilter.pattern().isEmpty() && !acceptFilter.match(relativePath).hasMatch())
+        || (!rejectFilter.pattern().isEmpty() && rejectFilter.match(relativePath).hasMatch())) {
+        return;
+    }
+
+    // The text after the link: "18-Oct-2026 12:00  12345" (nginx) or "2026-10-18 12:00  1.2K" (Apache)
+    static const QRegularExpression nginxStyle("(\\d{2}-\\w{3}-\\d{4} \\d{2}:\\d{2})\\s+(\\S+)");
+    static const QRegularExpression apacheStyle("(\\d{4}-\\d{2}-\\d{2} \\d{2}:\\d{2})\\s+(\\S+)");
+    QString text = rest;
+    text.replace(QRegularExpression("<[^>]*>"), " ");  // Table markup between the columns
+    QDateTime modified;
+    qint64 size = -1;
+    QRegularExpressionMatch match = nginxStyle.match(text);
+    if (match.hasMatch()) {
+        modified = QLocale::c().toDateTime(match.captured(1), "dd-MMM-yyyy HH:mm");
+    } else if ((match = apacheStyle.match(text)).hasMatch()) {
+        modified = QLocale::c().toDateTime(match.captured(1), "yyyy-MM-dd HH:mm");
+    }
+    if (match.hasMatch()) {
+        modified.setTimeSpec(Qt::UTC);
+        bool exact = false;
+        qint64 value = match.captured(2).toLongLong(&exact);
+        size = exact ? value : -1;  // "1.2K" and "-" are not precise enough to compare
+    }
+
+    if (isUnchanged(relativePath, size, modified)) {
+        skipped++;
+        return;
+    }
+    discovered++;
+    emit fileDiscovered(url, relativePath);
+}
+
+bool IndexCrawler::isSafeRelativePath(const QString &relativePath) const {
+    if (relativePath.contains('\\') || relativePath.contains(QChar(0)) || relativePath.startsWith('/')) {
+        return false;
+    }
+    for (const QString &segment : relativePath.split('/')) {
+        if (segment == "..") {
+            return false;
+        }
+    }
+    if (localRoot.isEmpty()) {
+        return true;
+    }
+    QString base = QDir::cleanPath(localRoot);
+    QString target = QDir::cleanPath(localRoot + relativePath);
+    return target.startsWith(base + "/");
+}
+
+bool IndexCrawler::isUnchanged(const QString &relativePath, qint64 size, const QDateTime &modified) const {
+    if (localRoot.isEmpty() || (size < 0 && !modified.isValid())) {
+        return false;  // Nothing to compare against
+    }
+    QFileInfo local(localRoot + relativePath);
+    if (!local.exists()) {
+        return false;
+    }
+    if (size >= 0 && local.size() != size) {
+        return false;
+    }
+    // Index times have minute resolution
+    return !modified.isValid() || local.lastModified().toUTC().addSecs(60) >= modified;
+}
+
+QString IndexCrawler::summary() const {
+    QString text;
+    QTextStream stream(&text);
+    stream << root.toString() << ": " << discovered << " files queued, " << skipped << " unchanged, "
+           << seen.size() - discovered - skipped << " other entries, " << failedListings << " listings failed";
+    return text;
+}
+Sourceaddresspool.h
+#ifndef SOURCEADDRESSPOOL_H
+#define SOURCEADDRESSPOOL_H
+
+#include <QHostAddress>
+#include <QList>
+#include <QMutex>
+#include <QNetworkRequest>
+#include "rateestimator.h"
+
+// Local addresses (one per NIC or uplink) that outgoing connections may be bound to.
+// Each transfer takes the address with the best smoothed throughput per active transfer;
+// addresses without a measurement yet count as the mean of the measured ones, so new
+// addresses are spread by how busy they are rather than all taking the next transfer.
+class SourceAddressPool {
+public:
+    // Request attribute read by BindingNetworkAccessManager: the local address to bind, as a string
+    static const QNetworkRequest::Attribute SourceAddressAttribute =
+        QNetworkRequest::Attribute(QNetworkRequest::User + 1);
+
+    static void setAddresses(const QList<QHostAddress> &addresses);
+    static QHostAddress acquire();  // Null when no addresses are configured
+    static void bytesReceived(const QHostAddress &address, qint64 bytes);
+    static void release(const QHostAddress &address);
+    static QString report();
+
+private:
+    struct Source {
+        QHostAddress address;
+        int active = 0;
+        RateEstimator rate;
+        qint64 bytes = 0;
+    };
+
+    static QMutex mutex;
+    static QList<Source> sources;
+};
+
+#endif // SOURCEADDRESSPOOL_H
+
+Sourceaddresspool.cpp
+#include "sourceaddresspool.h"
+#include <QMutexLocker>
+#include <QTextStream>
+
+QMutex SourceAddressPool::mutex;
+QList<SourceAddressPool::Source> SourceAddressPool::sources;
+
+void SourceAddressPool::setAddresses(const QList<QHostAddress> &addresses) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    sources.clear();
+    for (const QHostAddress &address : addresses) {
+        Source source;
+        source.address = address;
+        sources.append(source);
+    }
+}
+
+QHostAddress SourceAddressPool::acquire() {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    double measuredTotal = 0;
+    int measured = 0;
+    for (const Source &source : sources) {
+        if (source.bytes > 0) {
+            measuredTotal += source.rate.smoothedRate();
+            measured++;
+        }
+    }
+    double unmeasuredRate = measured > 0 ? measuredTotal / measured : 1.0;
+
+    int best = -1;
+    double bestScore = 0;
+    for (int i = 0; i < sources.size(); ++i) {
+        const Source &source = sources[i];
+        double rate = source.bytes == 0 ? unmeasuredRate : source.rate.smoothedRate();
+        double score = rate / (source.active + 1);
+        if (best < 0 || score > bestScore) {
+            best = i;
+            bestScore = score;
+        }
+    }
+    if (best < 0) {
+        return QHostAddress();
+    }
+    sources[best].active++;
+    return sources[best].address;
+}
+
+void SourceAddressPool::bytesReceived(const QHostAddress &address, qint64 bytes) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    for (Source &source : sources) {
+        if (source.address == address) {
+            source.bytes += bytes;
+            source.rate.addBytes(bytes);
+            return;
+        }
+    }
+}
+
+void SourceAddressPool::release(const QHostAddress &address) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    for (Source &source : sources) {
+        if (source.address == address) {
+            source.active = qMax(0, source.active - 1);
+            return;
+        }
+    }
+}
+
+QString SourceAddressPool::report() {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    QString text;
+    QTextStream stream(&text);
+    for (const Source &source : sources) {
+        stream << "Source " << source.address.toString() << ": " << source.bytes << " bytes, "
+               << QString::number(source.rate.smoothedRate() / (1024 * 1024), 'f', 2) << " MiB/s\n";
+    }
+    return text;
+}
+
+Bindingnetworkaccessmanager.h
+#ifndef BINDINGNETWORKACCESSMANAGER_H
+#define BINDINGNETWORKACCESSMANAGER_H
+
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QHostAddress>
+#include <QTcpSocket>
+#include <QTimer>
+
+// QNetworkAccessManager whose plain-HTTP GETs can be sent from a chosen local address.
+// Requests carrying SourceAddressPool::SourceAddressAttribute are served by BoundHttpReply;
+// everything else goes through Qt as usual.
+class BindingNetworkAccessManager : public QNetworkAccessManager {
+    Q_OBJECT
+
+public:
+    explicit BindingNetworkAccessManager(QObject *parent = nullptr);
+
+protected:
+    QNetworkReply *createRequest(Operation op, const QNetworkRequest &request,
+                                 QIODevice *outgoingData = nullptr) override;
+};
+
+// Minimal HTTP/1.0 GET over a QTcpSocket bound to a source address. HTTP/1.0 keeps the
+// response free of chunked encoding; one connection is used per request. It does not go
+// through QNetworkDiskCache, so cacheable requests must not carry a source address.
+// Fails with TimeoutError when nothing arrives for the request's transferTimeout().
+class BoundHttpReply : public QNetworkReply {
+    Q_OBJECT
+
+public:
+    BoundHttpReply(const QNetworkRequest &request, const QHostAddress &source, QObject *parent = nullptr);
+    void abort() override;
+    void setReadBufferSize(qint64 size) override;
+    qint64 bytesAvailable() const override;
+    bool isSequential() const override { return true; }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+
+private slots:
+    void onConnected();
+    void onReadyRead();
+    void onDisconnected();
+    void onSocketError(QAbstractSocket::SocketError socketError);
+    void onIdleTimeout();
+
+private:
+    static const int defaultTransferTimeoutMsecs = 60000;  // When the request sets none
+
+
+    bool parseHeaders();
+    void schedulePull();
+    void finishIfClosed();
+    void fail(NetworkError code, const QString &message);
+    void finishReply();
+
+    QTcpSocket *socket;
+    QTimer *idleTimer;          // Restarted whenever the server sends something
+    QByteArray headerBuffer;
+    QByteArray body;            // Received and not yet read by the consumer; at most readBufferSize() when set
+    bool headersDone;
+    bool pullScheduled;         // onReadyRead() queued to move data the socket held back
+    bool socketClosed;          // The server closed; finish once the socket's buffer is drained
+    qint64 contentLength;
+    qint64 received;
+};
+
+#endif // BINDINGNETWORKACCESSMANAGER_H
+
+Bindingnetworkaccessmanager.cpp
+#include "bindingnetworkaccessmanager.h"
+#include "sourceaddresspool.h"
+#include <QTimer>
+
+BindingNetworkAccessManager::BindingNetworkAccessManager(QObject *parent)
+    : QNetworkAccessManager(parent) {}
+
+QNetworkReply *BindingNetworkAccessManager::createRequest(Operation op, const QNetworkRequest &request,
+                                                          QIODevice *outgoingData) {
+    QHostAddress source(request.attribute(SourceAddressPool::SourceAddressAttribute).toString());
+    if (op == GetOperation && request.url().scheme() == "http" && !source.isNull()) {
+        return new BoundHttpReply(request, source, this);
+    }
+    return QNetworkAccessManager::createRequest(op, request, outgoingData);
+}
+
+BoundHttpReply::BoundHttpReply(const QNetworkRequest &request, const QHostAddress &source, QObject *parent)
+    : QNetworkReply(parent), socket(new QTcpSocket(this)), idleTimer(new QTimer(this)), headersDone(false),
+      pullScheduled(false), socketClosed(false), contentLength(-1), received(0) {
+    setRequest(request);
+    setUrl(request.url());
+    setOperation(QNetworkAccessManager::GetOperation);
+    open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+
+    connect(socket, &QTcpSocket::connected, this, &BoundHttpReply::onConnected);
+    connect(socket, &QTcpSocket::readyRead, this, &BoundHttpReply::onReadyRead);
+    connect(socket, &QTcpSocket::disconnected, this, &BoundHttpReply::onDisconnected);
+    connect(socket, &QAbstractSocket::errorOccurred, this, &BoundHttpReply::onSocketError);
+
+    idleTimer->setSingleShot(true);
+    idleTimer->setInterval(request.transferTimeout() > 0 ? request.transferTimeout() : defaultTransferTimeoutMsecs);
+    connect(idleTimer, &QTimer::timeout, this, &BoundHttpReply::onIdleTimeout);
+    idleTimer->start();  // Covers the connect and the wait for the first response bytes too
+
+    if (!socket->bind(source)) {
+        // Signals must not fire before the caller has had a chance to connect to them
+        QTimer::singleShot(0, this, [this, source]() {
+            fail(UnknownNetworkError, "Cannot bind to " + source.toString());
+        });
+        return;
+    }
+    socket->connectToHost(request.url().host(), request.url().port(80));
+}
+
+void BoundHttpReply::onConnected() {
+    QNetworkRequest req = request();
+    QByteArray path = url().path(QUrl::FullyEncoded).toLatin1();
+    if (path.isEmpty()) {
+        path = "/";
+    }
+    if (url().hasQuery()) {
+        path += "?" + url().query(QUrl::FullyEncoded).toLatin1();
+    }
+
+    QByteArray head = "GET " + path + " HTTP/1.0\r\n";
+    if (!req.hasRawHeader("Host")) {
+        head += "Host: " + url().host().toLatin1();
+        if (url().port() > 0) {
+            head += ":" + QByteArray::number(url().port());
+        }
+        head += "\r\n";
+    }
+    for (const QByteArray &name : req.rawHeaderList()) {
+        head += name + ": " + req.rawHeader(name) + "\r\n";
+    }
+    head += "Connection: close\r\n\r\n";
+    socket->write(head);
+    idleTimer->start();
+}
+
+void BoundHttpReply::onReadyRead() {
+    pullScheduled = false;
+    if (isFinished()) {
+        return;
+    }
+    idleTimer->start();
+    QByteArray data;
+    if (!headersDone) {
+        headerBuffer += socket->readAll();
+        int end = headerBuffer.indexOf("\r\n\r\n");
+        if (end < 0) {
+            finishIfClosed();
+            return;
+        }
+        data = headerBuffer.mid(end + 4);
+        headerBuffer.truncate(end);
+        headersDone = true;
+        if (!parseHeaders()) {
+            fail(ProtocolFailure, "Malformed HTTP response");
+            return;
+        }
+        emit metaDataChanged();
+    }
+
+    // With a read buffer size set, take no more than fits; the rest waits in the socket, whose
+    // own buffer has the same cap, so once that fills the kernel window closes on the sender
+    qint64 room = readBufferSize() > 0 ? readBufferSize() - body.size() - data.size() : socket->bytesAvailable();
+    if (room > 0) {
+        data += socket->read(room);
+    }
+    if (!data.isEmpty()) {
+        body += data;
+        received += data.size();
+        emit readyRead();
+        emit downloadProgress(received, contentLength);
+    }
+    finishIfClosed();
+}
+
+void BoundHttpReply::setReadBufferSize(qint64 size) {
+    QNetworkReply::setReadBufferSize(size);
+    socket->setReadBufferSize(size);
+    schedulePull();  // A larger cap makes room for data the socket is holding
+}
+
+void BoundHttpReply::schedulePull() {
+    if (!pullScheduled && socket->bytesAvailable() > 0) {
+        pullScheduled = true;  // Queued: readData() must not emit readyRead from inside a read
+        QTimer::singleShot(0, this, &BoundHttpReply::onReadyRead);
+    }
+}
+
+bool BoundHttpReply::parseHeaders() {
+    QList<QByteArray> lines = headerBuffer.split('\n');
+    QList<QByteArray> status = lines.takeFirst().trimmed().split(' ');  // "HTTP/1.1 206 Partial Content"
+    if (status.size() < 2 || !status[0].startsWith("HTTP/")) {
+        return false;
+    }
+    int code = status[1].toInt();
+    setAttribute(QNetworkRequest::HttpStatusCodeAttribute, code);
+    setAttribute(QNetworkRequest::HttpReasonPhraseAttribute, status.mid(2).join(' '));
+
+    for (const QByteArray &line : lines) {
+        int colon = line.indexOf(':');
+        if (colon > 0) {
+            setRawHeader(line.left(colon).trimmed(), line.mid(colon + 1).trimmed());
+        }
+    }
+    if (hasRawHeader("Content-Length")) {
+        contentLength = rawHeader("Content-Length").toLongLong();
+        setHeader(QNetworkRequest::ContentLengthHeader, contentLength);
+    }
+    if (hasRawHeader("Location")) {
+        setHeader(QNetworkRequest::LocationHeader, QUrl::fromEncoded(rawHeader("Location")));
+    }
+
+    // Same mapping of HTTP errors as QNetworkAccessManager's own backend
+    if (code == 401) {
+        setError(AuthenticationRequiredError, "Authentication required");
+    } else if (code == 403) {
+        setError(ContentAccessDenied, "Access denied");
+    } else if (code == 404) {
+        setError(ContentNotFoundError, "Not found");
+    } else if (code >= 400 && code < 500) {
+        setError(UnknownContentError, QString("HTTP %1").arg(code));
+    } else if (code >= 500) {
+        setError(UnknownServerError, QString("HTTP %1").arg(code));
+    }
+    return true;
+}
+
+void BoundHttpReply::onDisconnected() {
+    socketClosed = true;
+    finishIfClosed();
+}
+
+void BoundHttpReply::finishIfClosed() {
+    if (isFinished() || !socketClosed || socket->bytesAvailable() > 0) {
+        return;  // Still open, or the body held back in the socket has not been taken yet
+    }
+    if (!headersDone || (contentLength >= 0 && received < contentLength)) {
+        fail(RemoteHostClosedError, "Connection closed before the response was complete");
+        return;
+    }
+    finishReply();
+}
+
+void BoundHttpReply::onSocketError(QAbstractSocket::SocketError socketError) {
+    if (socketError == QAbstractSocket::RemoteHostClosedError) {
+        return;  // onDisconnected() decides whether the body was complete
+    }
+    NetworkError code = socketError == QAbstractSocket::ConnectionRefusedError ? ConnectionRefusedError
+                        : socketError == QAbstractSocket::HostNotFoundError    ? HostNotFoundError
+                        : socketError == QAbstractSocket::SocketTimeoutError   ? TimeoutError
+                                                                               : UnknownNetworkError;
+    fail(code, socket->errorString());
+}
+
+void BoundHttpReply::onIdleTimeout() {
+    if (readBufferSize() > 0 && body.size() >= readBufferSize()) {
+        idleTimer->start();  // The consumer is not reading; the server is not the one stalled
+        return;
+    }
+    fail(TimeoutError, "Transfer timed out");
+}
+
+void BoundHttpReply::fail(NetworkError code, const QString &message) {
+    if (isFinished()) {
+        return;
+    }
+    socket->abort();
+    setError(code, message);
+    emit errorOccurred(code);
+    finishReply();
+}
+
+void BoundHttpReply::finishReply() {
+    idleTimer->stop();
+    setFinished(true);
+    emit finished();
+}
+
+void BoundHttpReply::abort() {
+    fail(OperationCanceledError, "Operation canceled");
+}
+
+qint64 BoundHttpReply::bytesAvailable() const {
+    return body.size() + QNetworkReply::bytesAvailable();
+}
+
+qint64 BoundHttpReply::readData(char *data, qint64 maxSize) {
+    qint64 length = qMin<qint64>(maxSize, body.size());
+    memcpy(data, body.constData(), length);
+    body.remove(0, length);
+    schedulePull();
+    return length;
+}
+Diskwritepacer.h
+#ifndef DISKWRITEPACER_H
+#define DISKWRITEPACER_H
+
+#include <QElapsedTimer>
+#include <QString>
+#include <QVector>
+
+// Watches how long file writes take and asks the writer to back off when the p99 crosses a
+// threshold, or when the kernel reports I/O stalls for our cgroup. Independent of any
+// network rate limit: it only reacts to the disk.
+class DiskWritePacer {
+public:
+    DiskWritePacer();
+    void setThresholdMsecs(int msecs) { thresholdUsecs = qint64(msecs) * 1000; }
+    void recordWrite(qint64 usecs);
+    int delayMsecs() const { return currentDelayMsecs; }  // How long to hold off before the next drain
+
+    static bool applyIoPriority(int ioClass, int level);  // ioprio_set() for the calling thread
+    static void setThreadIoPriority(int ioClass, int level);  // The same, warning once per process on failure
+
+private:
+    void adjust();
+    static double cgroupIoPressure();  // "full avg10" from the cgroup's io.pressure, -1 if unavailable
+
+    static const int windowSize = 64;
+    static const int adjustEvery = 16;
+    static const int adjustIntervalMsecs = 250;  // Also adjust this often, since backing off makes writes rare
+    static const int maxDelayMsecs = 250;
+
+    qint64 thresholdUsecs;
+    QVector<qint64> latencies;  // Ring buffer of recent write latencies
+    int next;
+    int writesSinceAdjust;
+    QElapsedTimer sinceAdjust;
+    int currentDelayMsecs;
+};
+
+#endif // DISKWRITEPACER_H
+
+Diskwritepacer.cpp
+#include "diskwritepacer.h"
+#include <QAtomicInt>
+#include <QDebug>
+#include <QFile>
+#include <QTextStream>
+#include <algorithm>
+#include <cerrno>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+DiskWritePacer::DiskWritePacer()
+    : thresholdUsecs(0), next(0), writesSinceAdjust(0), currentDelayMsecs(0) {
+    sinceAdjust.start();
+}
+
+void DiskWritePacer::recordWrite(qint64 usecs) {
+    if (thresholdUsecs <= 0) {
+        return;
+    }
+    if (latencies.size() < windowSize) {
+        latencies.append(usecs);
+    } else {
+        latencies[next] = usecs;
+        next = (next + 1) % windowSize;
+    }
+    if (++writesSinceAdjust >= adjustEvery || sinceAdjust.hasExpired(adjustIntervalMsecs)) {
+        writesSinceAdjust = 0;
+        sinceAdjust.restart();
+        adjust();
+    }
+}
+
+void DiskWritePacer::adjust() {
+    QVector<qint64> sorted = latencies;
+    std::sort(sorted.begin(), sorted.end());
+    qint64 p99 = sorted[(sorted.size() * 99) / 100];
+
+    // Double the delay while the disk is over budget, halve it once it recovers
+    if (p99 > thresholdUsecs || cgroupIoPressure() > 10.0) {
+        currentDelayMsecs = qMin(maxDelayMsecs, qMax(10, currentDelayMsecs * 2));
+        // Judge the next step only on writes made at the new pace, not on the slow ones that caused it
+        latencies.clear();
+        next = 0;
+    } else {
+        currentDelayMsecs /= 2;
+    }
+}
+
+double DiskWritePacer::cgroupIoPressure() {
+    // cgroup v2: "0::/user.slice/..." in /proc/self/cgroup, pressure files under /sys/fs/cgroup
+    QFile cgroup("/proc/self/cgroup");
+    if (!cgroup.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return -1;
+    }
+    QString path;
+    for (const QString &line : QString::fromLatin1(cgroup.readAll()).split('\n')) {
+        if (line.startsWith("0::")) {
+            path = line.mid(3).trimmed();
+        }
+    }
+    QFile pressure("/sys/fs/cgroup" + path + "/io.pressure");
+    if (path.isEmpty() || !pressure.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return -1;
+    }
+    for (const QString &line : QString::fromLatin1(pressure.readAll()).split('\n')) {
+        if (line.startsWith("full ")) {
+            return line.section("avg10=", 1).section(' ', 0, 0).toDouble();
+        }
+    }
+    return -1;
+}
+
+bool DiskWritePacer::applyIoPriority(int ioClass, int level) {
+    if (ioClass <= 0) {
+        return true;
+    }
+    // IOPRIO_PRIO_VALUE(class, data); who = 0 with IOPRIO_WHO_PROCESS means the calling thread
+    const int ioprioClassShift = 13;
+    const int ioprioWhoProcess = 1;
+    int value = (ioClass << ioprioClassShift) | (ioClass == 3 ? 0 : qBound(0, level, 7));
+    return ::syscall(SYS_ioprio_set, ioprioWhoProcess, 0, value) == 0;
+}
+
+void DiskWritePacer::setThreadIoPriority(int ioClass, int level) {
+    if (applyIoPriority(ioClass, level)) {
+        return;
+    }
+    int error = errno;
+    static QAtomicInt warned;  // Every writer thread would fail the same way
+    if (warned.testAndSetRelaxed(0, 1)) {
+        qWarning().noquote() << "Cannot set the I/O priority:" << qt_error_string(error)
+                             << (ioClass == 1 ? "(the realtime class needs CAP_SYS_ADMIN)" : "");
+    }
+}
+Rateestimator.h
+#ifndef RATEESTIMATOR_H
+#define RATEESTIMATOR_H
+
+#include <QElapsedTimer>
+#include <QQueue>
+#include <QPair>
+
+// Transfer rate of one byte stream: the raw rate over a short sliding window, and an
+// exponentially smoothed rate that ETAs and scheduling decisions are based on. One class
+// serves connections, jobs, hosts and the global total so every consumer sees the same numbers.
+class RateEstimator {
+public:
+    explicit RateEstimator(qint64 windowMsecs = 2000, qint64 timeConstantMsecs = 5000);
+    void addBytes(qint64 bytes);
+    double currentRate() const;   // Bytes per second over the window
+    double smoothedRate() const;  // Bytes per second, EWMA
+    qint64 etaSecs(qint64 remainingBytes) const;  // -1 while the rate is unknown
+    void reset();
+
+private:
+    void advance() const;  // Folds finished buckets, including idle ones, into the EWMA
+
+    static const qint64 bucketMsecs = 250;
+
+    qint64 windowMsecs;
+    qint64 timeConstantMsecs;
+    QElapsedTimer clock;
+    mutable QQueue<QPair<qint64, qint64>> samples;  // (msecs, bytes) inside the window
+    mutable qint64 windowBytes;
+    mutable qint64 bucketStart;
+    mutable qint64 bucketBytes;
+    mutable double ewma;
+    mutable bool primed;            // ewma holds at least one bucket
+};
+
+#endif // RATEESTIMATOR_H
+
+Rateestimator.cpp
+#include "rateestimator.h"
+#include <cmath>
+
+RateEstimator::RateEstimator(qint64 windowMsecs, qint64 timeConstantMsecs)
+    : windowMsecs(windowMsecs), timeConstantMsecs(timeConstantMsecs) {
+    reset();
+}
+
+void RateEstimator::reset() {
+    clock.start();
+    samples.clear();
+    windowBytes = 0;
+    bucketStart = 0;
+    bucketBytes = 0;
+    ewma = 0;
+    primed = false;
+}
+
+void RateEstimator::addBytes(qint64 bytes) {
+    advance();
+    qint64 now = clock.elapsed();
+    samples.enqueue(qMakePair(now, bytes));
+    windowBytes += bytes;
+    bucketBytes += bytes;
+}
+
+void RateEstimator::advance() const {
+    qint64 now = clock.elapsed();
+    while (!samples.isEmpty() && samples.head().first < now - windowMsecs) {
+        windowBytes -= samples.dequeue().second;
+    }
+
+    double alpha = 1.0 - std::exp(-double(bucketMsecs) / timeConstantMsecs);
+    while (now - bucketStart >= bucketMsecs) {
+        double rate = bucketBytes * 1000.0 / bucketMsecs;
+        ewma = primed ? alpha * rate + (1 - alpha) * ewma : rate;
+        primed = true;
+        bucketBytes = 0;
+        bucketStart += bucketMsecs;
+
+        // After a long idle stretch, decay over all the empty buckets at once
+        qint64 idleBuckets = (now - bucketStart) / bucketMsecs;
+        if (idleBuckets > 1) {
+            ewma *= std::pow(1 - alpha, double(idleBuckets));
+            bucketStart += idleBuckets * bucketMsecs;
+        }
+    }
+}
+
+double RateEstimator::currentRate() const {
+    advance();
+    qint64 span = qMin(windowMsecs, clock.elapsed());
+    return span > 0 ? windowBytes * 1000.0 / span : 0;
+}
+
+double RateEstimator::smoothedRate() const {
+    advance();
+    return primed ? ewma : currentRate();
+}
+
+qint64 RateEstimator::etaSecs(qint64 remainingBytes) const {
+    double rate = smoothedRate();
+    if (rate <= 0 || remainingBytes < 0) {
+        return -1;
+    }
+    return qint64(std::ceil(remainingBytes / rate));
+}
+Downloadqueue.h
+#ifndef DOWNLOADQUEUE_H
+#define DOWNLOADQUEUE_H
+
+#include <QObject>
+#include <QDate>
+#include <QHash>
+#include <QMetaType>
+#include <QMutex>
+#include <QQueue>
+#include <QStringList>
+#include <QThread>
+#include <QTimer>
+#include <QVector>
+#include "downloader.h"
+
+// Bulk job submission. Queued jobs are plain structs; a Downloader exists only while its job
+// is active, and all of them run on one worker thread with their own network manager.
+// Results are collected and delivered as arrays every flush interval, so thousands of small
+// jobs cost a handful of signals rather than several each.
+// Jobs are queued per submitting client and slots are shared between clients first: a free
+// slot goes to the client with the fewest running jobs, then the fewest bytes today, so one
+// client's 100k-job batch cannot starve another's handful.
+// A client that reaches its daily byte quota has its running jobs paused and put back at the
+// head of its queue; they resume from their partial files once the day rolls over.
+class DownloadQueue : public QObject {
+    Q_OBJECT
+
+public:
+    struct JobResult {
+        quint64 id = 0;
+        QString clientId;
+        QString url;
+        QString filePath;  // Set on success
+        QString error;     // Set on failure
+    };
+
+    DownloadQueue();  // No parent: the queue lives on its own worker thread
+    ~DownloadQueue();
+    void setOptions(const DownloadOptions &opts);
+    void setMaxActive(int count);
+
+    // Limits applied to every client; 0 means unlimited
+    struct ClientQuota {
+        int maxActive = 0;
+        int maxQueued = 0;        // Jobs beyond this are failed at submission
+        qint64 bytesPerDay = 0;   // Once reached, the client's jobs are held until the next day
+    };
+    void setClientQuota(const ClientQuota &quota);
+
+    // Thread-safe; returns the id of the first job, the rest follow consecutively.
+    // Jobs without a client id are charged to "local". targetPaths is empty, or one save path per URL.
+    quint64 submit(const QStringList &urls, const QString &clientId = QString(), const QStringList &targetPaths = QStringList());
+
+signals:
+    void jobsFinished(const QVector<DownloadQueue::JobResult> &results);
+    void jobsFailed(const QVector<DownloadQueue::JobResult> &results);
+    void queueProgress(int queued, int active, int done, int failed);
+
+private slots:
+    void schedule();
+    void flush();
+
+private:
+    struct Job {
+        quint64 id = 0;
+        QString clientId;
+        QString url;
+        QString targetPath;  // Empty for ~/qt_downloads/<file name>
+    };
+
+    struct Client {
+        QQueue<Job> pending;
+        int active = 0;
+        qint64 bytesToday = 0;
+        QDate day;  // bytesToday is for this day
+    };
+
+    void jobEnded(Downloader *downloader, const Job &job, const QString &filePath, const QString &error);
+    void jobHeld(Downloader *downloader, const Job &job);
+    QString pickClient();  // Next client to get a slot, null if none may start a job
+    bool addBytes(const QString &clientId, qint64 bytes);  // True once the client is over its daily quota
+
+    static const int flushIntervalMsecs = 100;
+
+    QThread worker;
+    QNetworkAccessManager *networkManager;  // Created on the worker thread
+    QTimer *flushTimer;
+    QMutex mutex;                           // Guards everything below
+    DownloadOptions options;
+    int maxActive;
+    ClientQuota clientQuota;
+    quint64 nextId;
+    QHash<QString, Client> clients;
+    QStringList clientOrder;  // Round-robin order for breaking ties
+    int nextClient;
+    int queued;
+    int active;
+    int done;
+    int failed;
+    QVector<JobResult> finishedBatch;
+    QVector<JobResult> failedBatch;
+};
+
+Q_DECLARE_METATYPE(DownloadQueue::JobResult)
+
+#endif // DOWNLOADQUEUE_H
+
+Downloadqueue.cpp
+#include "downloadqueue.h"
+#include "bindingnetworkaccessmanager.h"
+#include "diskwritepacer.h"
+#include "numaplacement.h"
+#include "looplagmonitor.h"
+#include <QMutexLocker>
+#include <QSharedPointer>
+
+DownloadQueue::DownloadQueue()
+    : networkManager(nullptr), flushTimer(nullptr), maxActive(8), nextId(1), nextClient(0), queued(0), active(0),
+      done(0), failed(0) {
+    qRegisterMetaType<QVector<DownloadQueue::JobResult>>();
+    moveToThread(&worker);
+    worker.start();
+}
+
+DownloadQueue::~DownloadQueue() {
+    // Downloaders, their replies and the network manager belong to the worker thread and are destroyed there
+    QMetaObject::invokeMethod(this, [this]() {
+        const QObjectList owned = children();
+        qDeleteAll(owned);
+    }, Qt::BlockingQueuedConnection);
+    worker.quit();
+    worker.wait();
+}
+
+void DownloadQueue::setOptions(const DownloadOptions &opts) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    options = opts;
+}
+
+void DownloadQueue::setMaxActive(int count) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    maxActive = qMax(1, count);
+}
+
+void DownloadQueue::setClientQuota(const ClientQuota &quota) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    clientQuota = quota;
+}
+
+quint64 DownloadQueue::submit(const QStringList &urls, const QString &clientId, const QStringList &targetPaths) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    quint64 firstId = nextId;
+    QString id = clientId.isEmpty() ? QStringLiteral("local") : clientId;
+    if (!clients.contains(id)) {
+        clientOrder.append(id);
+    }
+    Client &client = clients[id];
+    client.pending.reserve(client.pending.size() + urls.size());
+    for (int i = 0; i < urls.size(); ++i) {
+        const QString &url = urls[i];
+        Job job;
+        job.id = nextId++;
+        job.clientId = id;
+        job.url = url;
+        job.targetPath = targetPaths.value(i);
+        if (clientQuota.maxQueued > 0 && client.pending.size() >= clientQuota.maxQueued) {
+            JobResult result;
+            result.id = job.id;
+            result.clientId = id;
+            result.url = url;
+            result.error = "Queue length quota exceeded";
+            failedBatch.append(result);
+            failed++;
+            continue;
+        }
+        client.pending.enqueue(job);
+        queued++;
+    }
+    QMetaObject::invokeMethod(this, "schedule", Qt::QueuedConnection);  // One wake-up per batch
+    return firstId;
+}
+
+void DownloadQueue::schedule() {
+    if (!networkManager) {
+        QMutexLocker locker(&mutex);  // Ensure thread safety
+        if (options.pinToNicNode) {
+            NumaPlacement::pinCurrentThread();  // First run on the worker thread
+        }
+        DiskWritePacer::setThreadIoPriority(options.ioPriorityClass, options.ioPriorityLevel);  // Its Downloaders write here
+        if (options.loopLagThresholdMsecs > 0) {
+            LoopLagMonitor::install("queue", options.loopLagThresholdMsecs);
+        }
+        locker.unlock();
+        networkManager = new BindingNetworkAccessManager(this);
+        flushTimer = new QTimer(this);
+        flushTimer->setInterval(flushIntervalMsecs);
+        connect(flushTimer, &QTimer::timeout, this, &DownloadQueue::flush);
+        flushTimer->start();
+    }
+
+    QVector<Job> starting;
+    DownloadOptions jobOptions;
+    {
+        QMutexLocker locker(&mutex);  // Ensure thread safety
+        while (active < maxActive) {
+            QString clientId = pickClient();
+            if (clientId.isNull()) {
+                break;
+            }
+            Client &client = clients[clientId];
+            starting.append(client.pending.dequeue());
+            client.active++;
+            queued--;
+            active++;
+        }
+        jobOptions = options;
+    }
+
+    // Started outside the lock: a job can fail synchronously and call jobEnded()
+    for (const Job &job : starting) {
+        Downloader *downloader = new Downloader(networkManager, job.url, this);
+        jobOptions.targetPath = job.targetPath;
+        downloader->setOptions(jobOptions);
+        connect(downloader, &Downloader::downloadFinished, this, [this, downloader, job](const QString &filePath) {
+            jobEnded(downloader, job, filePath, QString());
+        });
+        connect(downloader, &Downloader::downloadFailed, this, [this, downloader, job](const QString &error) {
+            jobEnded(downloader, job, QString(), error);
+        });
+        connect(downloader, &Downloader::pauseResumeStatusChanged, this, [this, downloader, job](bool paused) {
+            if (paused) {
+                jobHeld(downloader, job);
+            }
+        });
+        // Charge the client for bytes actually transferred, not for what a resume found on disk
+        QSharedPointer<qint64> counted(new qint64(-1));
+        connect(downloader, &Downloader::downloadProgress, this, [this, downloader, job, counted](qint64 received, qint64) {
+            if (*counted >= 0 && received > *counted && addBytes(job.clientId, received - *counted)) {
+                // Over the daily quota mid-transfer; paused outside the reply's signal, then requeued by jobHeld()
+                QTimer::singleShot(0, downloader, [downloader]() { downloader->pauseDownload(); });
+            }
+            *counted = received;
+        });
+        downloader->startDownload();
+        if (*counted < 0) {
+            *counted = downloader->getDownloadedBytes();
+        }
+    }
+}
+
+void DownloadQueue::jobEnded(Downloader *downloader, const Job &job, const QString &filePath, const QString &error) {
+    downloader->deleteLater();
+
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    JobResult result;
+    result.id = job.id;
+    result.clientId = job.clientId;
+    result.url = job.url;
+    result.filePath = filePath;
+    result.error = error;
+    if (error.isEmpty()) {
+        finishedBatch.append(result);
+        done++;
+    } else {
+        failedBatch.append(result);
+        failed++;
+    }
+    active--;
+    clients[job.clientId].active--;
+    QMetaObject::invokeMethod(this, "schedule", Qt::QueuedConnection);
+}
+
+void DownloadQueue::jobHeld(Downloader *downloader, const Job &job) {
+    disconnect(downloader, nullptr, this, nullptr);
+    downloader->deleteLater();  // The partial file and journal stay; the next start resumes from them
+
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    Client &client = clients[job.clientId];
+    client.pending.prepend(job);
+    client.active--;
+    active--;
+    queued++;
+    QMetaObject::invokeMethod(this, "schedule", Qt::QueuedConnection);  // Other clients may use the slot
+}
+
+QString DownloadQueue::pickClient() {
+    QString best;
+    int bestActive = 0;
+    qint64 bestBytes = 0;
+    QDate today = QDate::currentDate();
+    for (int i = 0; i < clientOrder.size(); ++i) {
+        int index = (nextClient + i) % clientOrder.size();
+        Client &client = clients[clientOrder[index]];
+        if (client.day != today) {
+            client.day = today;
+            client.bytesToday = 0;
+        }
+        if (client.pending.isEmpty() || (clientQuota.maxActive > 0 && client.active >= clientQuota.maxActive)
+            || (clientQuota.bytesPerDay > 0 && client.bytesToday >= clientQuota.bytesPerDay)) {
+            continue;
+        }
+        // Strictly better only, so ties go to whoever is next in the rotation
+        if (best.isNull() || client.active < bestActive || (client.active == bestActive && client.bytesToday < bestBytes)) {
+            best = clientOrder[index];
+            bestActive = client.active;
+            bestBytes = client.bytesToday;
+        }
+    }
+    if (!best.isNull()) {
+        nextClient = (clientOrder.indexOf(best) + 1) % clientOrder.size();
+    }
+    return best;
+}
+
+bool DownloadQueue::addBytes(const QString &clientId, qint64 bytes) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    Client &client = clients[clientId];
+    if (client.day != QDate::currentDate()) {
+        client.day = QDate::currentDate();
+        client.bytesToday = 0;
+    }
+    client.bytesToday += bytes;
+    return clientQuota.bytesPerDay > 0 && client.bytesToday >= clientQuota.bytesPerDay;
+}
+
+void DownloadQueue::flush() {
+    QVector<JobResult> finishedNow, failedNow;
+    int waiting, running, doneNow, failedCount;
+    {
+        QMutexLocker locker(&mutex);  // Ensure thread safety
+        if (queued > 0 && active < maxActive) {
+            // Jobs held back by a daily quota get going again once the day rolls over
+            QMetaObject::invokeMethod(this, "schedule", Qt::QueuedConnection);
+        }
+        if (finishedBatch.isEmpty() && failedBatch.isEmpty()) {
+            return;
+        }
+        finishedNow.swap(finishedBatch);
+        failedNow.swap(failedBatch);
+        waiting = queued;
+        running = active;
+        doneNow = done;
+        failedCount = failed;
+    }
+
+    if (!finishedNow.isEmpty()) {
+        emit jobsFinished(finishedNow);
+    }
+    if (!failedNow.isEmpty()) {
+        emit jobsFailed(failedNow);
+    }
+    emit queueProgress(waiting, running, doneNow, failedCount);
+}
+Peercache.h
+#ifndef PEERCACHE_H
+#define PEERCACHE_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QHostAddress>
+#include <QList>
+#include <QMutex>
+#include <QNetworkReply>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QThread>
+#include <QTimer>
+#include <QUdpSocket>
+#include <QVector>
+
+// Lets engine instances on a LAN serve their completed downloads to each other.
+// Discovery: "QTDM2 HAVE <instance> <port> <sha256> <size> <url key>" datagrams on a multicast
+// group, announced periodically and in answer to "QTDM2 WANT <instance> <url key>". The URL key
+// is the SHA-256 of the URL, so URLs (and any tokens in them) are not broadcast in the clear;
+// the instance id lets each engine drop its own looped-back datagrams. Transfer: a line protocol on
+// <port> that lists the SHA-256 of every 1 MiB piece of a file and serves single pieces.
+// Runs on its own worker thread, so slow or hostile peers never hold up the GUI or downloads.
+class PeerCache : public QObject {
+    Q_OBJECT
+
+public:
+    struct PeerOffer {
+        QHostAddress address;
+        quint16 port = 0;
+        QByteArray sha256;  // Of the whole file
+        qint64 size = 0;
+    };
+
+    static const qint64 pieceSize = 1024 * 1024;
+
+    static PeerCache *instance();  // Null until start() has succeeded
+    static bool start(quint16 servePort, quint16 discoveryPort);
+    static void shutdown();
+
+    // SHA-256 from a response's Repr-Digest (RFC 9530) or Digest (RFC 3230) header; empty if none
+    static QByteArray originDigest(const QNetworkReply *reply);
+
+    // Thread-safe
+    void publish(const QString &url, const QString &filePath, const QByteArray &sha256, qint64 size);
+    QList<PeerOffer> offersFor(const QString &url);
+    bool hasOffers();  // Any peer has announced anything within the offer TTL
+    void query(const QString &url);
+
+private slots:
+    void onDatagram();
+    void onConnection();
+    void announceAll();  // Also drops expired offers
+
+private:
+    struct Published {
+        QByteArray urlKey;
+        QString filePath;
+        qint64 size = 0;
+        QVector<QByteArray> pieceHashes;  // Computed on first request
+    };
+
+    struct Seen {
+        PeerOffer offer;
+        qint64 seenAt = 0;  // Milliseconds since epoch
+    };
+
+    struct Upload {
+        bool busy = false;        // A command is being answered; later ones wait in the socket
+        QFile *source = nullptr;  // Piece being sent
+        qint64 remaining = 0;
+    };
+
+    PeerCache();
+    ~PeerCache();
+    static QByteArray urlKey(const QString &url);  // Hex SHA-256, as sent in datagrams
+    bool listen(quint16 servePort, quint16 discoveryPort);
+    void announce(const QByteArray &sha256, const Published &published, const QHostAddress &to, quint16 port);
+    void processCommands(QTcpSocket *client);
+    void serveCommand(QTcpSocket *client, const QByteArray &line);
+    void hashPieces(QTcpSocket *client, const QByteArray &sha256, const Published &entry, const QByteArray &line);
+    void sendPiece(QTcpSocket *client);
+    void commandDone(QTcpSocket *client);
+
+    static PeerCache *self;
+    static const int announceIntervalMsecs = 10000;
+    static const qint64 offerTtlMsecs = 60000;
+    static const qint64 sendChunkBytes = 64 * 1024;
+    static const qint64 maxQueuedBytes = 256 * 1024;  // Per client, before waiting for bytesWritten
+
+    QThread worker;
+    QTcpServer *server;                       // Created on the worker thread, like everything below
+    QUdpSocket *discovery;
+    QTimer *announceTimer;
+    QHostAddress group;
+    quint16 discoveryPort;
+    QByteArray instanceId;                    // Random per process, carried in every datagram
+    QHash<QTcpSocket *, Upload> uploads;      // Worker thread only
+    QMutex mutex;                             // Guards the two tables below
+    QHash<QByteArray, Published> published;   // By whole-file SHA-256
+    QHash<QByteArray, QList<Seen>> offers;    // By URL key
+};
+
+#endif // PEERCACHE_H
+
+Peercache.cpp
+#include "peercache.h"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QMutexLocker>
+#include <QNetworkDatagram>
+#include <QPointer>
+#include <QRandomGenerator>
+#include <QRunnable>
+#include <QThreadPool>
+#include <functional>
+
+PeerCache *PeerCache::self = nullptr;
+
+namespace {
+class HashTask : public QRunnable {
+public:
+    HashTask(std::function<void()> work) : work(std::move(work)) {}
+    void run() override { work(); }
+
+private:
+    std::function<void()> work;
+};
+}
+
+PeerCache::PeerCache()
+    : server(nullptr), discovery(nullptr), announceTimer(nullptr), group("239.255.42.42"), discoveryPort(0) {
+    quint64 id = QRandomGenerator::system()->generate64();
+    instanceId = QByteArray(reinterpret_cast<const char *>(&id), sizeof(id)).toHex();
+    moveToThread(&worker);
+    worker.start();
+}
+
+PeerCache::~PeerCache() {
+    worker.quit();
+    worker.wait();
+}
+
+PeerCache *PeerCache::instance() {
+    return self;
+}
+
+QByteArray PeerCache::urlKey(const QString &url) {
+    return QCryptographicHash::hash(url.toUtf8(), QCryptographicHash::Sha256).toHex();
+}
+
+QByteArray PeerCache::originDigest(const QNetworkReply *reply) {
+    // Repr-Digest: sha-256=:<base64>:, sha-512=:...:
+    for (const QByteArray &item : reply->rawHeader("Repr-Digest").split(',')) {
+        QByteArray entry = item.trimmed();
+        if (entry.toLower().startsWith("sha-256=:") && entry.endsWith(':')) {
+            QByteArray digest = QByteArray::fromBase64(entry.mid(9, entry.size() - 10));
+            if (digest.size() == 32) {
+                return digest;
+            }
+        }
+    }
+    // Digest: SHA-256=<base64>
+    for (const QByteArray &item : reply->rawHeader("Digest").split(',')) {
+        QByteArray entry = item.trimmed();
+        if (entry.toLower().startsWith("sha-256=")) {
+            QByteArray digest = QByteArray::fromBase64(entry.mid(8));
+            if (digest.size() == 32) {
+                return digest;
+            }
+        }
+    }
+    return QByteArray();
+}
+
+bool PeerCache::start(quint16 servePort, quint16 port) {
+    PeerCache *cache = new PeerCache();
+    bool ok = false;
+    QMetaObject::invokeMethod(cache, [cache, servePort, port, &ok]() { ok = cache->listen(servePort, port); },
+                              Qt::BlockingQueuedConnection);
+    if (!ok) {
+        QMetaObject::invokeMethod(cache, [cache]() { qDeleteAll(cache->children()); }, Qt::BlockingQueuedConnection);
+        delete cache;
+        return false;
+    }
+    self = cache;
+    return true;
+}
+
+void PeerCache::shutdown() {
+    if (!self) {
+        return;
+    }
+    // Sockets and timers belong to the worker thread and are destroyed there
+    QMetaObject::invokeMethod(self, [cache = self]() {
+        for (const Upload &upload : cache->uploads) {
+            delete upload.source;
+        }
+        cache->uploads.clear();
+        const QObjectList owned = cache->children();
+        qDeleteAll(owned);  // A copy: each delete removes itself from children()
+    }, Qt::BlockingQueuedConnection);
+    delete self;
+    self = nullptr;
+}
+
+bool PeerCache::listen(quint16 servePort, quint16 port) {
+    discoveryPort = port;
+    server = new QTcpServer(this);
+    discovery = new QUdpSocket(this);
+    announceTimer = new QTimer(this);
+
+    if (!server->listen(QHostAddress::Any, servePort)) {
+        return false;
+    }
+    // Shared so several instances on one host can all listen for announcements
+    if (!discovery->bind(QHostAddress::AnyIPv4, port, QUdpSocket::ShareAddress | QUdpSocket::ReuseAddressHint)) {
+        return false;
+    }
+    discovery->joinMulticastGroup(group);
+    discovery->setSocketOption(QAbstractSocket::MulticastLoopbackOption, 1);
+
+    connect(server, &QTcpServer::newConnection, this, &PeerCache::onConnection);
+    connect(discovery, &QUdpSocket::readyRead, this, &PeerCache::onDatagram);
+    connect(announceTimer, &QTimer::timeout, this, &PeerCache::announceAll);
+    announceTimer->start(announceIntervalMsecs);
+    return true;
+}
+
+void PeerCache::publish(const QString &url, const QString &filePath, const QByteArray &sha256, qint64 size) {
+    Published entry;
+    entry.urlKey = urlKey(url);
+    entry.filePath = filePath;
+    entry.size = size;
+    {
+        QMutexLocker locker(&mutex);  // Ensure thread safety
+        published.insert(sha256, entry);
+    }
+    QMetaObject::invokeMethod(this, [this, sha256, entry]() { announce(sha256, entry, group, discoveryPort); });
+}
+
+QList<PeerCache::PeerOffer> PeerCache::offersFor(const QString &url) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    QList<PeerOffer> result;
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for (const Seen &seen : offers.value(urlKey(url))) {
+        if (now - seen.seenAt < offerTtlMsecs) {
+            result.append(seen.offer);
+        }
+    }
+    return result;
+}
+
+bool PeerCache::hasOffers() {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for (const QList<Seen> &list : qAsConst(offers)) {
+        for (const Seen &seen : list) {
+            if (now - seen.seenAt < offerTtlMsecs) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void PeerCache::query(const QString &url) {
+    QByteArray datagram = "QTDM2 WANT " + instanceId + " " + urlKey(url);
+    QMetaObject::invokeMethod(this, [this, datagram]() { discovery->writeDatagram(datagram, group, discoveryPort); });
+}
+
+void PeerCache::announce(const QByteArray &sha256, const Published &entry, const QHostAddress &to, quint16 port) {
+    QByteArray datagram = "QTDM2 HAVE " + instanceId + " " + QByteArray::number(server->serverPort()) + " "
+                          + sha256.toHex() + " " + QByteArray::number(entry.size) + " " + entry.urlKey;
+    discovery->writeDatagram(datagram, to, port);
+}
+
+void PeerCache::announceAll() {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    for (auto it = published.constBegin(); it != published.constEnd(); ++it) {
+        announce(it.key(), it.value(), group, discoveryPort);
+    }
+
+    // Peers that went away stop re-announcing; forget their offers once the TTL has passed
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for (auto it = offers.begin(); it != offers.end();) {
+        QList<Seen> &list = it.value();
+        for (int i = list.size() - 1; i >= 0; --i) {
+            if (now - list[i].seenAt >= offerTtlMsecs) {
+                list.removeAt(i);
+            }
+        }
+        it = list.isEmpty() ? offers.erase(it) : it + 1;
+    }
+}
+
+void PeerCache::onDatagram() {
+    while (discovery->hasPendingDatagrams()) {
+        QNetworkDatagram datagram = discovery->receiveDatagram();
+        QList<QByteArray> fields = datagram.data().split(' ');
+        if (fields.size() < 4 || fields[0] != "QTDM2" || fields[2] == instanceId) {
+            continue;  // Not ours to answer, or our own datagram looped back
+        }
+        if (fields.size() == 4 && fields[1] == "WANT") {
+            QMutexLocker locker(&mutex);  // Ensure thread safety
+            for (auto it = published.constBegin(); it != published.constEnd(); ++it) {
+                if (it->urlKey == fields[3]) {
+                    announce(it.key(), it.value(), datagram.senderAddress(), datagram.senderPort());
+                }
+            }
+        } else if (fields.size() == 7 && fields[1] == "HAVE") {
+            quint16 port = fields[3].toUShort();
+            Seen seen;
+            seen.offer.address = datagram.senderAddress();
+            seen.offer.port = port;
+            seen.offer.sha256 = QByteArray::fromHex(fields[4]);
+            seen.offer.size = fields[5].toLongLong();
+            seen.seenAt = QDateTime::currentMSecsSinceEpoch();
+
+            QMutexLocker locker(&mutex);  // Ensure thread safety
+            QList<Seen> &list = offers[fields[6]];
+            for (int i = list.size() - 1; i >= 0; --i) {
+                if (list[i].offer.address == seen.offer.address && list[i].offer.port == port) {
+                    list.removeAt(i);
+                }
+            }
+            list.append(seen);
+        }
+    }
+}
+
+void PeerCache::onConnection() {
+    while (QTcpSocket *client = server->nextPendingConnection()) {
+        uploads.insert(client, Upload());
+        connect(client, &QTcpSocket::disconnected, this, [this, client]() {
+            delete uploads.value(client).source;
+            uploads.remove(client);
+            client->deleteLater();
+        });
+        connect(client, &QTcpSocket::readyRead, this, [this, client]() { processCommands(client); });
+        connect(client, &QTcpSocket::bytesWritten, this, [this, client]() { sendPiece(client); });
+    }
+}
+
+void PeerCache::processCommands(QTcpSocket *client) {
+    // One command at a time: the next is read only when the previous answer has been sent
+    while (uploads.contains(client) && !uploads[client].busy && client->canReadLine()) {
+        serveCommand(client, client->readLine().trimmed());
+    }
+}
+
+void PeerCache::serveCommand(QTcpSocket *client, const QByteArray &line) {
+    // "PIECES <sha256>" or "GET <sha256> <index>"
+    QList<QByteArray> fields = line.split(' ');
+    QByteArray sha256 = fields.size() >= 2 ? QByteArray::fromHex(fields[1]) : QByteArray();
+
+    Published entry;
+    {
+        QMutexLocker locker(&mutex);  // Ensure thread safety
+        if (!published.contains(sha256)) {
+            client->write("ERR\n");
+            return;
+        }
+        entry = published.value(sha256);
+    }
+    if (entry.pieceHashes.isEmpty() && entry.size > 0) {
+        hashPieces(client, sha256, entry, line);  // Answers the command once the hashes are known
+        return;
+    }
+
+    if (fields[0] == "PIECES") {
+        QByteArray response = "OK " + QByteArray::number(pieceSize) + " " + QByteArray::number(entry.pieceHashes.size()) + "\n";
+        for (const QByteArray &hash : entry.pieceHashes) {
+            response += hash.toHex() + "\n";
+        }
+        client->write(response);
+    } else if (fields[0] == "GET" && fields.size() >= 3) {
+        int index = fields[2].toInt();
+        QFile *source = new QFile(entry.filePath);
+        if (index < 0 || index >= entry.pieceHashes.size() || !source->open(QIODevice::ReadOnly)
+            || !source->seek(qint64(index) * pieceSize)) {
+            delete source;
+            client->write("ERR\n");
+            return;
+        }
+        Upload &upload = uploads[client];
+        upload.busy = true;
+        upload.source = source;
+        upload.remaining = qMin(pieceSize, entry.size - qint64(index) * pieceSize);
+        client->write("OK " + QByteArray::number(upload.remaining) + "\n");
+        sendPiece(client);
+    } else {
+        client->write("ERR\n");
+    }
+}
+
+void PeerCache::hashPieces(QTcpSocket *client, const QByteArray &sha256, const Published &entry, const QByteArray &line) {
+    // Reading and hashing a whole file takes a while: do it on the pool, with no lock held
+    uploads[client].busy = true;
+    QPointer<QTcpSocket> guard = client;
+    QThreadPool::globalInstance()->start(new HashTask([this, guard, sha256, entry, line]() {
+        QVector<QByteArray> hashes;
+        QFile source(entry.filePath);
+        bool ok = source.open(QIODevice::ReadOnly) && source.size() == entry.size;  // Else moved or changed
+        while (ok && !source.atEnd()) {
+            hashes.append(QCryptographicHash::hash(source.read(pieceSize), QCryptographicHash::Sha256));
+        }
+
+        QMetaObject::invokeMethod(this, [this, guard, sha256, entry, line, hashes, ok]() {
+            if (ok) {
+                QMutexLocker locker(&mutex);  // Ensure thread safety
+                auto it = published.find(sha256);
+                if (it != published.end() && it->filePath == entry.filePath) {
+                    it->pieceHashes = hashes;
+                }
+            } else {
+                QMutexLocker locker(&mutex);  // Ensure thread safety
+                published.remove(sha256);     // Stop announcing what can no longer be served
+            }
+            if (!guard) {
+                return;
+            }
+            commandDone(guard);
+            if (ok) {
+                serveCommand(guard, line);
+            } else {
+                guard->write("ERR\n");
+            }
+            processCommands(guard);
+        });
+    }));
+}
+
+void PeerCache::sendPiece(QTcpSocket *client) {
+    // Paced on bytesWritten so a slow reader holds at most maxQueuedBytes of ours in memory
+    if (!uploads.contains(client) || !uploads[client].source) {
+        return;
+    }
+    Upload &upload = uploads[client];
+    while (upload.remaining > 0 && client->bytesToWrite() < maxQueuedBytes) {
+        QByteArray chunk = upload.source->read(qMin(sendChunkBytes, upload.remaining));
+        if (chunk.isEmpty()) {
+            client->abort();  // The file shrank under us; the reader sees a short piece and drops us
+            return;
+        }
+        client->write(chunk);
+        upload.remaining -= chunk.size();
+    }
+    if (upload.remaining == 0) {
+        commandDone(client);
+        processCommands(client);
+    }
+}
+
+void PeerCache::commandDone(QTcpSocket *client) {
+    Upload &upload = uploads[client];
+    delete upload.source;
+    upload.source = nullptr;
+    upload.remaining = 0;
+    upload.busy = false;
+}
+
+Peerfetch.h
+#ifndef PEERFETCH_H
+#define PEERFETCH_H
+
+#include <QObject>
+#include <QMap>
+#include <QQueue>
+#include <QTcpSocket>
+#include <QVector>
+#include "peercache.h"
+
+// Pulls one file from the peers offering it: the piece list from the first peer, then pieces
+// from all of them in parallel. Each piece is checked against its SHA-256 and handed out in
+// file order; a peer that errors or sends a bad piece is dropped and its piece retried elsewhere.
+class PeerFetch : public QObject {
+    Q_OBJECT
+
+public:
+    PeerFetch(const QList<PeerCache::PeerOffer> &offers, QObject *parent = nullptr);
+    void start();
+    void abort();  // Drops every peer connection; finished() is not emitted
+
+signals:
+    void pieceReady(const QByteArray &data);
+    void finished(bool ok);
+
+private:
+    struct Connection {
+        QTcpSocket *socket = nullptr;
+        QByteArray buffer;
+        int piece = -1;         // Piece being fetched, -1 when idle or waiting for the piece list
+        qint64 expected = -1;   // Body length from the "OK <length>" line
+    };
+
+    void onReadyRead(Connection *connection);
+    bool parseManifest(Connection *connection);
+    void requestNext(Connection *connection);
+    void dropConnection(Connection *connection);
+    void deliver();
+    void finish(bool ok);
+
+    static const int maxPiecesAhead = 16;  // Bounds memory held for out-of-order pieces
+
+    QList<PeerCache::PeerOffer> offers;
+    QList<Connection *> connections;
+    QVector<QByteArray> pieceHashes;
+    QQueue<int> todo;
+    QMap<int, QByteArray> ready;
+    int nextToDeliver;
+    bool manifestLoaded;
+    bool done;
+};
+
+#endif // PEERFETCH_H
+
+Peerfetch.cpp
+#include "peerfetch.h"
+#include <QCryptographicHash>
+
+PeerFetch::PeerFetch(const QList<PeerCache::PeerOffer> &offers, QObject *parent)
+    : QObject(parent), offers(offers), nextToDeliver(0), manifestLoaded(false), done(false) {}
+
+void PeerFetch::start() {
+    for (const PeerCache::PeerOffer &offer : offers) {
+        Connection *connection = new Connection;
+        connection->socket = new QTcpSocket(this);
+        connections.append(connection);
+
+        connect(connection->socket, &QTcpSocket::readyRead, this, [this, connection]() { onReadyRead(connection); });
+        connect(connection->socket, &QAbstractSocket::errorOccurred, this, [this, connection]() {
+            dropConnection(connection);
+        });
+        connect(connection->socket, &QTcpSocket::connected, this, [this, connection]() {
+            if (connection == connections.first() && !manifestLoaded) {
+                connection->socket->write("PIECES " + offers.first().sha256.toHex() + "\n");
+            } else {
+                requestNext(connection);
+            }
+        });
+        connection->socket->connectToHost(offer.address, offer.port);
+    }
+}
+
+void PeerFetch::onReadyRead(Connection *connection) {
+    connection->buffer += connection->socket->readAll();
+
+    if (!manifestLoaded && connection->piece < 0) {
+        if (parseManifest(connection)) {
+            for (Connection *other : connections) {
+                if (other->socket->state() == QAbstractSocket::ConnectedState) {
+                    requestNext(other);
+                }
+            }
+        }
+        return;
+    }
+
+    while (connection->piece >= 0) {
+        if (connection->expected < 0) {
+            int newline = connection->buffer.indexOf('\n');
+            if (newline < 0) {
+                return;
+            }
+            QByteArray header = connection->buffer.left(newline);
+            connection->buffer.remove(0, newline + 1);
+            if (!header.startsWith("OK ")) {
+                dropConnection(connection);
+                return;
+            }
+            connection->expected = header.mid(3).toLongLong();
+        }
+        if (connection->buffer.size() < connection->expected) {
+            return;
+        }
+
+        QByteArray piece = connection->buffer.left(connection->expected);
+        connection->buffer.remove(0, connection->expected);
+        if (QCryptographicHash::hash(piece, QCryptographicHash::Sha256) != pieceHashes[connection->piece]) {
+            dropConnection(connection);  // Corrupt or different content: stop trusting this peer
+            return;
+        }
+        ready.insert(connection->piece, piece);
+        connection->piece = -1;
+        connection->expected = -1;
+        deliver();
+        requestNext(connection);
+    }
+}
+
+bool PeerFetch::parseManifest(Connection *connection) {
+    // "OK <pieceSize> <count>\n" followed by one hex SHA-256 per line
+    int newline = connection->buffer.indexOf('\n');
+    if (newline < 0) {
+        return false;
+    }
+    QList<QByteArray> header = connection->buffer.left(newline).split(' ');
+    if (header.size() != 3 || header[0] != "OK" || header[1].toLongLong() != PeerCache::pieceSize) {
+        finish(false);
+        return false;
+    }
+    int count = header[2].toInt();
+    qint64 size = offers.first().size;
+    if (count != (size + PeerCache::pieceSize - 1) / PeerCache::pieceSize) {
+        finish(false);
+        return false;
+    }
+    QList<QByteArray> lines = connection->buffer.mid(newline + 1).split('\n');
+    if (lines.size() <= count) {
+        return false;  // Wait for the rest of the list
+    }
+
+    for (int i = 0; i < count; ++i) {
+        pieceHashes.append(QByteArray::fromHex(lines[i]));
+        todo.enqueue(i);
+    }
+    connection->buffer.clear();
+    manifestLoaded = true;
+    if (count == 0) {
+        finish(true);
+    }
+    return true;
+}
+
+void PeerFetch::requestNext(Connection *connection) {
+    if (done || !manifestLoaded || connection->piece >= 0 || todo.isEmpty() || todo.head() >= nextToDeliver + maxPiecesAhead) {
+        return;
+    }
+    connection->piece = todo.dequeue();
+    connection->socket->write("GET " + offers.first().sha256.toHex() + " " + QByteArray::number(connection->piece) + "\n");
+}
+
+void PeerFetch::dropConnection(Connection *connection) {
+    if (!connections.contains(connection)) {
+        return;
+    }
+    connections.removeOne(connection);
+    if (connection->piece >= 0) {
+        todo.prepend(connection->piece);  // Someone else fetches it
+    }
+    connection->socket->abort();
+    connection->socket->deleteLater();
+    delete connection;
+
+    if (connections.isEmpty()) {
+        finish(false);
+        return;
+    }
+    if (!manifestLoaded) {
+        Connection *next = connections.first();  // Ask another peer for the piece list
+        if (next->socket->state() == QAbstractSocket::ConnectedState) {
+            next->socket->write("PIECES " + offers.first().sha256.toHex() + "\n");
+        }
+        return;
+    }
+    for (Connection *other : connections) {
+        requestNext(other);
+    }
+}
+
+void PeerFetch::deliver() {
+    while (ready.contains(nextToDeliver)) {
+        emit pieceReady(ready.take(nextToDeliver));
+        nextToDeliver++;
+    }
+    if (nextToDeliver == pieceHashes.size()) {
+        finish(true);
+        return;
+    }
+    for (Connection *connection : connections) {
+        requestNext(connection);  // The window may have opened up
+    }
+}
+
+void PeerFetch::abort() {
+    done = true;
+    for (Connection *connection : connections) {
+        connection->socket->abort();
+        delete connection;
+    }
+    connections.clear();
+}
+
+void PeerFetch::finish(bool ok) {
+    if (done) {
+        return;
+    }
+    abort();
+    emit finished(ok);
+}
+Proxyserver.h
+#ifndef PROXYSERVER_H
+#define PROXYSERVER_H
+
+#include <QObject>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QNetworkAccessManager>
+#include <QNetworkDiskCache>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QThread>
+#include <QTimer>
+#include "downloader.h"
+#include "downloadregistry.h"
+
+// Local HTTP forward proxy in front of the engine, for tools that can be pointed at
+// http_proxy. GETs of absolute http:// URLs are served from a content cache directory,
+// then from what the engine already has: downloads in flight or completed, and the
+// --http-cache disk cache. The rest is fetched once by a Downloader however many clients
+// ask, and every client streams from the file as it grows. Requests carrying credentials
+// are relayed uncached.
+class ProxyServer : public QObject {
+    Q_OBJECT
+
+public:
+    ProxyServer(const QString &cacheDir, qint64 maxAgeSecs);  // No parent: runs on its own worker thread
+    ~ProxyServer();
+    void setOptions(const DownloadOptions &opts);
+    void setHttpCacheDirectory(const QString &dir);  // Of the engine's QNetworkDiskCache; only read
+    void listen(quint16 port);
+
+private slots:
+    void onConnection();
+
+private:
+    struct Client {
+        QTcpSocket *socket = nullptr;
+        QByteArray request;
+        QIODevice *source = nullptr;  // The cached or growing file being sent
+        QSharedPointer<DownloadRegistry::Progress> following;  // An engine download being followed
+        QNetworkReply *relayed = nullptr;  // Origin reply of an uncached request
+        bool headerSent = false;
+        qint64 sent = 0;
+        qint64 available = 0;  // Bytes of source that may be sent
+        bool complete = false; // available is the final size
+    };
+
+    struct Fetch {
+        Downloader *downloader = nullptr;
+        QString partPath;
+        QString journalPath;
+        QByteArray headers;    // Origin headers passed on, "Name: value\r\n" each
+        bool started = false;  // headers are known; clients may be answered
+        QList<Client *> clients;
+    };
+
+    void onRequest(Client *client);
+    void serveCached(Client *client, const QString &path);
+    bool serveFromHttpCache(Client *client, const QUrl &url);
+    void follow(Client *client, const QSharedPointer<DownloadRegistry::Progress> &progress);
+    void pollFollowers();
+    void joinFetch(Client *client, const QString &url);
+    void relay(Client *client, const QUrl &url, const QList<QByteArray> &headerLines);
+    void pumpRelay(Client *client);
+    void fetchEnded(const QString &url, const QString &error);
+    void pump(Client *client);
+    void sendHead(Client *client, const QByteArray &status, const QByteArray &headers);
+    void reject(Client *client, const QByteArray &status);
+    void dropClient(Client *client);
+    QString cachePath(const QString &url) const;
+    qint64 freshnessSecs(const QByteArray &headers) const;  // How long a response may be served from cache; -1: never
+
+    static const qint64 clientBufferBytes = 1024 * 1024;  // Per-client socket backlog before waiting
+    static const qint64 readChunkBytes = 256 * 1024;
+    static const int followPollMsecs = 100;
+
+    QThread worker;
+    QTcpServer *server;
+    QNetworkAccessManager *networkManager;  // Created on the worker thread
+    QNetworkDiskCache *httpCache;           // Null without --http-cache
+    QTimer *followTimer;                    // Runs while clients follow engine downloads
+    QString cacheDir;
+    qint64 maxAgeSecs;
+    DownloadOptions options;
+    QHash<QString, Fetch *> fetches;        // In-flight misses by URL
+    QList<Client *> clients;                // Every open connection
+    QList<Client *> followers;
+};
+
+#endif // PROXYSERVER_H
+
+Proxyserver.cpp
+#include "proxyserver.h"
+#include "bindingnetworkaccessmanager.h"
+#include "diskwritepacer.h"
+#include "looplagmonitor.h"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QNetworkReply>
+#include <QRegularExpression>
+#include <QUrl>
+
+namespace {
+// Headers that describe one connection and are never forwarded (RFC 9110 section 7.6.1)
+bool isHopByHop(const QByteArray &name) {
+    static const QList<QByteArray> names = {"connection", "keep-alive", "proxy-authenticate", "proxy-authorization",
+                                            "proxy-connection", "te", "trailer", "transfer-encoding", "upgrade"};
+    return names.contains(name.toLower());
+}
+
+// Origin headers as passed on by the proxy. The engine receives decoded bodies and the
+// proxy closes the connection after each, so length and encoding are left out as well.
+// Fetches ask for "bytes=0-" and get a 206, but clients get the whole body under a 200,
+// so Content-Range goes too.
+QByteArray forwardedHeaders(const QList<QPair<QByteArray, QByteArray>> &headers) {
+    QByteArray result;
+    for (const auto &header : headers) {
+        QByteArray name = header.first.toLower();
+        if (!isHopByHop(name) && name != "content-length" && name != "content-encoding" && name != "content-range") {
+            result += header.first + ": " + header.second + "\r\n";
+        }
+    }
+    return result;
+}
+}
+
+ProxyServer::ProxyServer(const QString &cacheDir, qint64 maxAgeSecs)
+    : server(nullptr), networkManager(nullptr), httpCache(nullptr), followTimer(nullptr), cacheDir(cacheDir),
+      maxAgeSecs(maxAgeSecs) {
+    QDir().mkpath(cacheDir);
+    moveToThread(&worker);
+    worker.start();
+}
+
+ProxyServer::~ProxyServer() {
+    // Clients, fetches and every QObject they use belong to the worker thread and are torn down there
+    QMetaObject::invokeMethod(this, [this]() {
+        for (Client *client : QList<Client *>(clients)) {
+            dropClient(client);
+        }
+        qDeleteAll(fetches);
+        fetches.clear();
+        const QObjectList owned = children();
+        qDeleteAll(owned);
+    }, Qt::BlockingQueuedConnection);
+    worker.quit();
+    worker.wait();
+}
+
+void ProxyServer::setOptions(const DownloadOptions &opts) {
+    QMetaObject::invokeMethod(this, [this, opts]() { options = opts; });
+}
+
+void ProxyServer::setHttpCacheDirectory(const QString &dir) {
+    QMetaObject::invokeMethod(this, [this, dir]() {
+        // A second instance on the engine's directory; entries are only read, so it never expires any
+        httpCache = new QNetworkDiskCache(this);
+        httpCache->setCacheDirectory(dir);
+    });
+}
+
+void ProxyServer::listen(quint16 port) {
+    QMetaObject::invokeMethod(this, [this, port]() {
+        DiskWritePacer::setThreadIoPriority(options.ioPriorityClass, options.ioPriorityLevel);  // Fetches write here
+        if (options.loopLagThresholdMsecs > 0) {
+            LoopLagMonitor::install("proxy", options.loopLagThresholdMsecs);
+        }
+        networkManager = new BindingNetworkAccessManager(this);
+        server = new QTcpServer(this);
+        followTimer = new QTimer(this);
+        connect(followTimer, &QTimer::timeout, this, &ProxyServer::pollFollowers);
+        connect(server, &QTcpServer::newConnection, this, &ProxyServer::onConnection);
+        if (!server->listen(QHostAddress::LocalHost, port)) {
+            qWarning() << "Proxy disabled:" << server->errorString();
+        }
+    });
+}
+
+QString ProxyServer::cachePath(const QString &url) const {
+    return cacheDir + "/" + QCryptographicHash::hash(url.toUtf8(), QCryptographicHash::Sha1).toHex();
+}
+
+qint64 ProxyServer::freshnessSecs(const QByteArray &headers) const {
+    QByteArray cacheControl;
+    for (const QByteArray &line : headers.split('\n')) {
+        if (line.toLower().startsWith("cache-control:")) {
+            cacheControl += "," + line.mid(14).trimmed().toLower();
+        } else if (line.toLower().startsWith("set-cookie:")) {
+            return -1;  // Meant for whoever triggered the fetch
+        }
+    }
+    // A shared cache that never revalidates stores nothing marked no-cache either
+    if (cacheControl.contains("no-store") || cacheControl.contains("private") || cacheControl.contains("no-cache")) {
+        return -1;
+    }
+    QRegularExpressionMatch shared = QRegularExpression("s-maxage=(\\d+)").match(QString::fromLatin1(cacheControl));
+    QRegularExpressionMatch any = QRegularExpression("max-age=(\\d+)").match(QString::fromLatin1(cacheControl));
+    if (shared.hasMatch()) {
+        return qMin(maxAgeSecs, shared.captured(1).toLongLong());
+    }
+    if (any.hasMatch()) {
+        return qMin(maxAgeSecs, any.captured(1).toLongLong());
+    }
+    return maxAgeSecs;
+}
+
+void ProxyServer::onConnection() {
+    while (QTcpSocket *socket = server->nextPendingConnection()) {
+        Client *client = new Client;
+        client->socket = socket;
+        clients.append(client);
+        connect(socket, &QTcpSocket::readyRead, this, [this, client]() {
+            if (client->request.endsWith("\r\n\r\n")) {
+                client->socket->readAll();  // One request per connection; ignore anything after it
+                return;
+            }
+            client->request += client->socket->readAll();
+            if (client->request.contains("\r\n\r\n")) {
+                client->request.truncate(client->request.indexOf("\r\n\r\n") + 4);
+                onRequest(client);
+            } else if (client->request.size() > 64 * 1024) {
+                reject(client, "431 Request Header Fields Too Large");
+            }
+        });
+        connect(socket, &QTcpSocket::bytesWritten, this, [this, client]() { pump(client); });
+        connect(socket, &QTcpSocket::disconnected, this, [this, client]() { dropClient(client); });
+    }
+}
+
+void ProxyServer::onRequest(Client *client) {
+    QList<QByteArray> lines = client->request.split('\n');
+    QList<QByteArray> requestLine = lines.takeFirst().trimmed().split(' ');
+    if (requestLine.size() != 3) {
+        reject(client, "400 Bad Request");
+        return;
+    }
+    if (requestLine[0] != "GET") {
+        reject(client, "501 Not Implemented");  // Includes CONNECT: HTTPS is not proxied
+        return;
+    }
+    QUrl url(QString::fromUtf8(requestLine[1]));
+    if (url.scheme() != "http" || url.host().isEmpty()) {
+        reject(client, "400 Bad Request");
+        return;
+    }
+
+    QList<QByteArray> headerLines;
+    bool personal = false;
+    for (const QByteArray &line : lines) {
+        QByteArray header = line.trimmed();
+        if (header.isEmpty()) {
+            continue;
+        }
+        QByteArray name = header.left(header.indexOf(':')).trimmed().toLower();
+        if (name == "authorization" || name == "cookie") {
+            personal = true;
+        }
+        if (!isHopByHop(name) && name != "host") {
+            headerLines.append(header);  // Proxy credentials are ours; the origin never sees them
+        }
+    }
+    if (personal) {
+        relay(client, url, headerLines);  // Never cached or shared with other clients
+        return;
+    }
+
+    QString key = url.toString(QUrl::RemoveFragment);
+    if (fetches.contains(key)) {
+        joinFetch(client, key);
+        return;
+    }
+    QString path = cachePath(key);
+    QFileInfo cached(path);
+    if (cached.exists()) {
+        QFile headers(path + ".headers");
+        headers.open(QIODevice::ReadOnly);
+        if (cached.lastModified().secsTo(QDateTime::currentDateTime()) < freshnessSecs(headers.readAll())) {
+            serveCached(client, path);
+            return;
+        }
+    }
+    // Whatever the engine is downloading anyway, or finished recently enough, is not fetched a second time.
+    // Engine downloads keep no origin headers, so a completed one is fresh for --proxy-max-age from its mtime.
+    QSharedPointer<DownloadRegistry::Progress> local = DownloadRegistry::lookup(key);
+    if (local && (local->state.loadAcquire() != DownloadRegistry::Completed
+                  || QFileInfo(local->path).lastModified().secsTo(QDateTime::currentDateTime()) < maxAgeSecs)) {
+        follow(client, local);
+        return;
+    }
+    if (serveFromHttpCache(client, url)) {
+        return;
+    }
+    joinFetch(client, key);
+}
+
+void ProxyServer::serveCached(Client *client, const QString &path) {
+    client->source = new QFile(path);
+    if (!client->source->open(QIODevice::ReadOnly)) {
+        reject(client, "500 Internal Server Error");
+        return;
+    }
+    client->available = client->source->size();
+    client->complete = true;
+
+    // Origin headers are kept next to files the proxy fetched itself; engine downloads have none
+    QFile headers(path + ".headers");
+    QByteArray origin = headers.open(QIODevice::ReadOnly) ? headers.readAll() : QByteArray();
+    sendHead(client, "200 OK", origin + "Content-Length: " + QByteArray::number(client->available)
+                               + "\r\nX-Cache: HIT\r\n");
+    pump(client);
+}
+
+bool ProxyServer::serveFromHttpCache(Client *client, const QUrl &url) {
+    if (!httpCache) {
+        return false;
+    }
+    QNetworkCacheMetaData meta = httpCache->metaData(url);
+    if (!meta.isValid() || meta.attributes().value(QNetworkRequest::HttpStatusCodeAttribute).toInt() != 200
+        || !meta.expirationDate().isValid() || meta.expirationDate() <= QDateTime::currentDateTimeUtc()) {
+        return false;  // Stale entries would need revalidation; a fresh fetch is simpler
+    }
+    client->source = httpCache->data(url);
+    if (!client->source) {
+        return false;
+    }
+    client->available = client->source->size();
+    client->complete = true;
+
+    // The cache holds the decoded body, so its length and encoding headers no longer apply
+    sendHead(client, "200 OK", forwardedHeaders(meta.rawHeaders()) + "Content-Length: "
+                               + QByteArray::number(client->available) + "\r\nX-Cache: HIT\r\n");
+    pump(client);
+    return true;
+}
+
+void ProxyServer::follow(Client *client, const QSharedPointer<DownloadRegistry::Progress> &progress) {
+    if (progress->state.loadAcquire() == DownloadRegistry::Completed) {
+        serveCached(client, progress->path);
+        return;
+    }
+    client->source = new QFile(progress->path);
+    if (!client->source->open(QIODevice::ReadOnly)) {
+        reject(client, "500 Internal Server Error");
+        return;
+    }
+    client->following = progress;
+    client->available = progress->available.loadAcquire();
+    followers.append(client);
+    if (!followTimer->isActive()) {
+        followTimer->start(followPollMsecs);
+    }
+    // Like a fetch of our own: the size is not known yet, so the body is delimited by closing
+    sendHead(client, "200 OK", "X-Cache: HIT\r\n");
+    pump(client);
+}
+
+void ProxyServer::pollFollowers() {
+    // The downloads run on other threads; their progress is read from the registry's atomics
+    const QList<Client *> polled = followers;  // abort() below removes from the list
+    for (Client *client : polled) {
+        int state = client->following->state.loadAcquire();
+        qint64 available = client->following->available.loadAcquire();
+        if (state == DownloadRegistry::Abandoned || available < client->sent) {
+            client->socket->abort();  // Paused, failed or restarted under this client
+            continue;
+        }
+        client->available = available;
+        if (state == DownloadRegistry::Completed) {
+            client->complete = true;
+            followers.removeOne(client);
+        }
+        pump(client);
+    }
+    if (followers.isEmpty()) {
+        followTimer->stop();
+    }
+}
+
+void ProxyServer::joinFetch(Client *client, const QString &url) {
+    Fetch *fetch = fetches.value(url);
+    if (!fetch) {
+        DownloadOptions fetchOptions = options;
+        fetchOptions.targetPath = cachePath(url) + ".part";
+        fetchOptions.streaming = true;
+        fetchOptions.encryptionKey.clear();  // Clients read the cache file as-is
+        fetchOptions.staging = false;        // and follow it while it grows
+        fetchOptions.journalDir = cacheDir + "/journal";  // Never resumed as a download of the user's
+        fetchOptions.shared = false;         // Moved into the cache when done, so not listed in the registry
+        fetchOptions.peerCache = false;      // Clients get the origin's headers, which peers do not have
+        fetchOptions.dedup = false;          // The .part file is renamed into the cache; a link would race that
+        fetchOptions.httpCache = false;      // The proxy is the cache here; not counted against the engine's hit rate
+
+        fetch = new Fetch;
+        fetch->partPath = fetchOptions.targetPath;
+        fetch->journalPath = Downloader::journalPath(url, fetchOptions);
+        QFile::remove(fetch->partPath);  // Left by an earlier run; its bytes cannot be trusted
+        QFile::remove(fetch->journalPath);
+        fetches.insert(url, fetch);
+
+        fetch->downloader = new Downloader(networkManager, url, this);
+        fetch->downloader->setOptions(fetchOptions);
+        connect(fetch->downloader, &Downloader::responseHeaders, this,
+                [this, url](const QList<QNetworkReply::RawHeaderPair> &headers) {
+            Fetch *fetch = fetches.value(url);
+            if (!fetch || fetch->started) {
+                return;
+            }
+            fetch->headers = forwardedHeaders(headers);
+            fetch->started = true;
+            const QList<Client *> waitingClients = fetch->clients;
+            for (Client *waiting : waitingClients) {
+                sendHead(waiting, "200 OK", fetch->headers + "X-Cache: MISS\r\n");
+                pump(waiting);
+            }
+        });
+        connect(fetch->downloader, &Downloader::contiguousOffsetChanged, this, [this, url](qint64 offset) {
+            Fetch *fetch = fetches.value(url);
+            if (!fetch) {
+                return;
+            }
+            const QList<Client *> waitingClients = fetch->clients;  // abort() below removes from the list
+            for (Client *waiting : waitingClients) {
+                if (offset < waiting->sent) {
+                    waiting->socket->abort();  // The engine restarted the file under this client
+                    continue;
+                }
+                waiting->available = offset;
+                pump(waiting);
+            }
+        });
+        connect(fetch->downloader, &Downloader::downloadFinished, this, [this, url]() { fetchEnded(url, QString()); });
+        connect(fetch->downloader, &Downloader::downloadFailed, this, [this, url](const QString &error) {
+            fetchEnded(url, error);
+        });
+        fetch->downloader->startDownload();
+        if (!fetches.contains(url)) {
+            reject(client, "502 Bad Gateway");  // Failed synchronously, e.g. the file could not be created
+            return;
+        }
+    }
+
+    client->source = new QFile(fetch->partPath);
+    if (!client->source->open(QIODevice::ReadOnly)) {
+        reject(client, "500 Internal Server Error");
+        return;
+    }
+    client->available = fetch->downloader->getContiguousOffset();
+    fetch->clients.append(client);
+    // Answered once the origin's headers are in. The size is not known yet, so the body is
+    // delimited by closing the connection
+    if (fetch->started) {
+        sendHead(client, "200 OK", fetch->headers + "X-Cache: MISS\r\n");
+        pump(client);
+    }
+}
+
+void ProxyServer::fetchEnded(const QString &url, const QString &error) {
+    Fetch *fetch = fetches.take(url);
+    if (!fetch) {
+        return;
+    }
+    fetch->downloader->deleteLater();
+
+    if (error.isEmpty()) {
+        QString path = cachePath(url);
+        QFile::remove(path);
+        QFile::remove(path + ".headers");
+        if (freshnessSecs(fetch->headers) > 0) {
+            QFile headers(path + ".headers");
+            if (headers.open(QIODevice::WriteOnly)) {
+                headers.write(fetch->headers);
+                headers.close();
+            }
+            QFile::rename(fetch->partPath, path);  // Open readers keep their handle across the rename
+        } else {
+            QFile::remove(fetch->partPath);  // Not for sharing; the clients that asked still get it
+        }
+    } else {
+        qWarning().noquote() << "Proxy fetch failed:" << url << error;
+        QFile::remove(fetch->partPath);
+        QFile::remove(fetch->journalPath);
+    }
+
+    const QList<Client *> waitingClients = fetch->clients;
+    for (Client *client : waitingClients) {
+        if (!error.isEmpty()) {
+            if (client->headerSent) {
+                client->socket->abort();  // Too late for an error status; a short body tells the client
+            } else {
+                reject(client, "502 Bad Gateway");
+            }
+            continue;
+        }
+        if (!client->headerSent) {
+            sendHead(client, "200 OK", fetch->headers + "X-Cache: MISS\r\n");
+        }
+        client->available = client->source->size();
+        client->complete = true;
+        pump(client);
+    }
+    delete fetch;
+}
+
+void ProxyServer::relay(Client *client, const QUrl &url, const QList<QByteArray> &headerLines) {
+    QNetworkRequest request(url);
+    for (const QByteArray &line : headerLines) {
+        int colon = line.indexOf(':');
+        request.setRawHeader(line.left(colon).trimmed(), line.mid(colon + 1).trimmed());
+    }
+    if (!request.hasRawHeader("Accept-Encoding")) {
+        // Otherwise the manager asks for gzip and decodes it, and the origin's headers no longer fit the body
+        request.setRawHeader("Accept-Encoding", "identity");
+    }
+    client->relayed = networkManager->get(request);
+    client->relayed->setReadBufferSize(clientBufferBytes);  // Read from the origin only as fast as the client takes it
+    connect(client->relayed, &QNetworkReply::readyRead, this, [this, client]() { pumpRelay(client); });
+    connect(client->relayed, &QNetworkReply::finished, this, [this, client]() { pumpRelay(client); });
+}
+
+void ProxyServer::pumpRelay(Client *client) {
+    QNetworkReply *reply = client->relayed;
+    if (!client->headerSent) {
+        int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        if (!status && !reply->isFinished()) {
+            return;  // Headers not in yet
+        }
+        QByteArray reason = reply->attribute(QNetworkRequest::HttpReasonPhraseAttribute).toByteArray();
+        QByteArray headers;
+        for (const QNetworkReply::RawHeaderPair &header : reply->rawHeaderPairs()) {
+            if (!isHopByHop(header.first)) {
+                headers += header.first + ": " + header.second + "\r\n";
+            }
+        }
+        sendHead(client, status ? QByteArray::number(status) + " " + reason : QByteArray("502 Bad Gateway"), headers);
+    }
+    while (reply->bytesAvailable() > 0 && client->socket->bytesToWrite() < clientBufferBytes) {
+        client->socket->write(reply->read(readChunkBytes));
+    }
+    if (reply->isFinished() && reply->bytesAvailable() == 0) {
+        client->socket->disconnectFromHost();
+    }
+}
+
+void ProxyServer::pump(Client *client) {
+    if (client->relayed) {
+        pumpRelay(client);  // bytesWritten: room for more of the origin's body
+        return;
+    }
+    if (!client->headerSent) {
+        return;  // Waiting for the origin's headers
+    }
+    // Keep at most clientBufferBytes queued so a slow client does not pull the file into memory
+    while (client->sent < client->available && client->socket->bytesToWrite() < clientBufferBytes) {
+        client->source->seek(client->sent);
+        QByteArray chunk = client->source->read(qMin(readChunkBytes, client->available - client->sent));
+        if (chunk.isEmpty()) {
+            break;
+        }
+        client->socket->write(chunk);
+        client->sent += chunk.size();
+    }
+    if (client->complete && client->sent >= client->available) {
+        client->socket->disconnectFromHost();
+    }
+}
+
+void ProxyServer::sendHead(Client *client, const QByteArray &status, const QByteArray &headers) {
+    client->headerSent = true;
+    client->socket->write("HTTP/1.1 " + status + "\r\n" + headers + "Connection: close\r\n\r\n");
+}
+
+void ProxyServer::reject(Client *client, const QByteArray &status) {
+    client->socket->write("HTTP/1.1 " + status + "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+    client->socket->disconnectFromHost();
+}
+
+void ProxyServer::dropClient(Client *client) {
+    for (Fetch *fetch : fetches) {
+        fetch->clients.removeOne(client);  // The fetch itself carries on and fills the cache
+    }
+    followers.removeOne(client);
+    clients.removeOne(client);
+    if (client->relayed) {
+        disconnect(client->relayed, nullptr, this, nullptr);
+        client->relayed->abort();  // Nobody is left to read the rest from the origin
+        client->relayed->deleteLater();
+    }
+    disconnect(client->socket, nullptr, this, nullptr);  // A late disconnected() must not drop it twice
+    client->socket->deleteLater();
+    delete client->source;
+    delete client;
+}
+Numaplacement.h
+#ifndef NUMAPLACEMENT_H
+#define NUMAPLACEMENT_H
+
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+// Keeps download workers on the CPUs of the NUMA node the NIC is attached to, so received
+// data is hashed and written, and worker buffers are allocated (first touch), next to the
+// NIC rather than across the socket interconnect. Topology comes from sysfs; on single-node
+// machines or when the NIC reports no node, everything here is a no-op.
+class NumaPlacement {
+public:
+    static bool setInterface(const QString &interfaceName);  // False if the NIC's node is unknown
+    static int nicNode() { return nicNodeId; }
+    static bool pinCurrentThread();  // Restrict the calling thread to the NIC node's CPUs
+    static bool onNicNode();         // Is the calling thread running on the NIC's node right now? Lock-free
+
+private:
+    static QVector<int> parseCpuList(const QString &list);  // "0-7,16-23"
+    static QString readSysfs(const QString &path);
+
+    static QMutex mutex;
+    static int nicNodeId;           // -1 until setInterface() succeeds
+    static QVector<int> nodeCpus;   // CPUs of nicNodeId
+    static QVector<int> cpuToNode;  // Indexed by CPU number
+};
+
+#endif // NUMAPLACEMENT_H
+
+Numaplacement.cpp
+#include "numaplacement.h"
+#include <QDir>
+#include <QFile>
+#include <QMutexLocker>
+#include <pthread.h>
+#include <sched.h>
+
+QMutex NumaPlacement::mutex;
+int NumaPlacement::nicNodeId = -1;
+QVector<int> NumaPlacement::nodeCpus;
+QVector<int> NumaPlacement::cpuToNode;
+
+QString NumaPlacement::readSysfs(const QString &path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return QString();
+    }
+    return QString::fromLatin1(file.readAll()).trimmed();
+}
+
+QVector<int> NumaPlacement::parseCpuList(const QString &list) {
+    QVector<int> cpus;
+    for (const QString &range : list.split(',', Qt::SkipEmptyParts)) {
+        int first = range.section('-', 0, 0).toInt();
+        int last = range.contains('-') ? range.section('-', 1, 1).toInt() : first;
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.append(cpu);
+        }
+    }
+    return cpus;
+}
+
+bool NumaPlacement::setInterface(const QString &interfaceName) {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    bool ok = false;
+    int node = readSysfs("/sys/class/net/" + interfaceName + "/device/numa_node").toInt(&ok);
+    if (!ok || node < 0) {
+        return false;  // Virtual interface, or firmware that does not report locality
+    }
+
+    QDir nodes("/sys/devices/system/node");
+    for (const QString &entry : nodes.entryList(QStringList() << "node*", QDir::Dirs)) {
+        int id = entry.mid(4).toInt();
+        for (int cpu : parseCpuList(readSysfs(nodes.filePath(entry) + "/cpulist"))) {
+            if (cpu >= cpuToNode.size()) {
+                cpuToNode.resize(cpu + 1, -1);
+            }
+            cpuToNode[cpu] = id;
+        }
+    }
+    nodeCpus = parseCpuList(readSysfs(nodes.filePath(QString("node%1/cpulist").arg(node))));
+    if (nodeCpus.isEmpty()) {
+        return false;
+    }
+    nicNodeId = node;
+    return true;
+}
+
+bool NumaPlacement::pinCurrentThread() {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    if (nicNodeId < 0) {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : nodeCpus) {
+        CPU_SET(cpu, &set);
+    }
+    // The whole node rather than one core: the scheduler still balances workers within it
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+bool NumaPlacement::onNicNode() {
+    int cpu = sched_getcpu();  // vDSO, cheap enough for every chunk
+    // No lock: the tables are filled once by setInterface() in main(), before any worker starts
+    return cpu >= 0 && cpu < cpuToNode.size() && cpuToNode[cpu] == nicNodeId;
+}
+Filecipher.h
+#ifndef FILECIPHER_H
+#define FILECIPHER_H
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QString>
+#include <QVector>
+
+// AES-256-CTR encryption of a download as it is written (OpenSSL EVP, which uses AES-NI).
+// CTR lets any byte be encrypted or decrypted on its own, so resume, tail verification and
+// rehashing work at arbitrary offsets. Each run of writes gets a fresh random IV, recorded in
+// "<file>.iv" before any ciphertext reaches the disk, so rewritten ranges never reuse keystream.
+// The .iv file has one "<start offset> <IV hex>" line per run, sorted by offset; a run covers
+// the bytes up to the next one's start, and byte n of a run is at keystream offset n - start
+// from its IV taken as a 128-bit big-endian counter. --decrypt prints a file's plaintext.
+class FileCipher {
+public:
+    static QByteArray loadKey(const QString &keyFilePath);  // 32 raw bytes or 64 hex digits; empty on error
+    static QString ivFilePath(const QString &filePath) { return filePath + ".iv"; }
+    static bool decryptFile(const QString &filePath, const QByteArray &key, QIODevice *output);
+
+    bool open(const QString &filePath, const QByteArray &key);
+    bool covers(qint64 size) const;  // Are there IVs for every byte below size?
+
+    // out may equal in. A write at any offset but the end of the last one starts a new IV run.
+    // False if the IV could not be recorded or OpenSSL failed; nothing may be written then.
+    bool encrypt(qint64 offset, const char *in, char *out, qint64 length);
+    bool decrypt(qint64 offset, char *data, qint64 length);
+
+private:
+    struct Run {
+        qint64 start = 0;
+        QByteArray iv;  // 16 bytes: counter block for the byte at start
+    };
+
+    bool crypt(const Run &run, qint64 offset, const char *in, char *out, qint64 length) const;
+    bool saveRuns();
+
+    QString ivPath;
+    QByteArray key;
+    QVector<Run> runs;   // Sorted by start; each covers bytes up to the next one's start
+    qint64 writeEnd = -1;
+};
+
+#endif // FILECIPHER_H
+
+Filecipher.cpp
+#include "filecipher.h"
+#include <QFile>
+#include <QRandomGenerator>
+#include <QSaveFile>
+#include <QTextStream>
+#include <cstring>
+#include <openssl/evp.h>
+
+QByteArray FileCipher::loadKey(const QString &keyFilePath) {
+    QFile keyFile(keyFilePath);
+    if (!keyFile.open(QIODevice::ReadOnly)) {
+        return QByteArray();
+    }
+    QByteArray key = keyFile.readAll();
+    if (key.size() != 32) {
+        key = QByteArray::fromHex(key.trimmed());
+    }
+    return key.size() == 32 ? key : QByteArray();
+}
+
+bool FileCipher::decryptFile(const QString &filePath, const QByteArray &fileKey, QIODevice *output) {
+    FileCipher cipher;
+    QFile input(filePath);
+    if (!cipher.open(filePath, fileKey) || !input.open(QIODevice::ReadOnly) || !cipher.covers(input.size())) {
+        return false;
+    }
+    qint64 offset = 0;
+    QByteArray block;
+    while (!(block = input.read(1024 * 1024)).isEmpty()) {
+        if (!cipher.decrypt(offset, block.data(), block.size()) || output->write(block) != block.size()) {
+            return false;
+        }
+        offset += block.size();
+    }
+    return true;
+}
+
+bool FileCipher::open(const QString &filePath, const QByteArray &fileKey) {
+    ivPath = ivFilePath(filePath);
+    key = fileKey;
+    runs.clear();
+    writeEnd = -1;  // The first write of this run always gets a new IV
+
+    QFile ivFile(ivPath);
+    if (!ivFile.exists()) {
+        return true;
+    }
+    if (!ivFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return false;
+    }
+    // One "<start> <iv hex>" line per run
+    QTextStream stream(&ivFile);
+    while (!stream.atEnd()) {
+        QStringList fields = stream.readLine().split(' ');
+        if (fields.size() == 2) {
+            Run run;
+            run.start = fields[0].toLongLong();
+            run.iv = QByteArray::fromHex(fields[1].toLatin1());
+            runs.append(run);
+        }
+    }
+    return true;
+}
+
+bool FileCipher::covers(qint64 size) const {
+    return size == 0 || (!runs.isEmpty() && runs.first().start == 0);
+}
+
+bool FileCipher::encrypt(qint64 offset, const char *in, char *out, qint64 length) {
+    if (offset != writeEnd) {
+        // Anything at or past offset is being rewritten (or was never written): new IV from here
+        while (!runs.isEmpty() && runs.last().start >= offset) {
+            runs.removeLast();
+        }
+        Run run;
+        run.start = offset;
+        run.iv.resize(16);
+        QRandomGenerator::system()->fillRange(reinterpret_cast<quint32 *>(run.iv.data()), 4);
+        runs.append(run);
+        if (!saveRuns()) {
+            writeEnd = -1;  // The next attempt starts another run and tries to record it again
+            return false;
+        }
+    }
+    if (!crypt(runs.last(), offset, in, out, length)) {
+        writeEnd = -1;
+        return false;
+    }
+    writeEnd = offset + length;
+    return true;
+}
+
+bool FileCipher::decrypt(qint64 offset, char *data, qint64 length) {
+    // A range can span several runs; each part is decrypted with the run it belongs to
+    for (int i = runs.size() - 1; i >= 0 && length > 0; --i) {
+        qint64 end = offset + length;
+        if (runs[i].start >= end) {
+            continue;
+        }
+        qint64 from = qMax(offset, runs[i].start);
+        if (!crypt(runs[i], from, data + (from - offset), data + (from - offset), end - from)) {
+            return false;
+        }
+        length = from - offset;
+    }
+    return length == 0;  // Bytes before the first run have no IV
+}
+
+bool FileCipher::crypt(const Run &run, qint64 offset, const char *in, char *out, qint64 length) const {
+    // Counter block for offset: the run's IV plus the number of whole blocks since its start,
+    // as a 128-bit big-endian addition, then skip into the block
+    qint64 relative = offset - run.start;
+    unsigned char counter[16];
+    memcpy(counter, run.iv.constData(), 16);
+    quint64 carry = quint64(relative / 16);
+    for (int i = 15; i >= 0 && carry; --i) {
+        carry += counter[i];
+        counter[i] = static_cast<unsigned char>(carry & 0xff);
+        carry >>= 8;
+    }
+
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) {
+        return false;
+    }
+    bool ok = EVP_EncryptInit_ex(ctx, EVP_aes_256_ctr(), nullptr,
+                                 reinterpret_cast<const unsigned char *>(key.constData()), counter) == 1;
+    int produced = 0;
+    unsigned char skip[16] = {};
+    if (ok && relative % 16) {
+        ok = EVP_EncryptUpdate(ctx, skip, &produced, skip, int(relative % 16)) == 1;
+    }
+    static const qint64 maxUpdate = 1 << 30;  // EVP lengths are ints
+    for (qint64 done = 0; ok && done < length; done += maxUpdate) {
+        int part = int(qMin(maxUpdate, length - done));
+        ok = EVP_EncryptUpdate(ctx, reinterpret_cast<unsigned char *>(out + done), &produced,
+                               reinterpret_cast<const unsigned char *>(in + done), part) == 1
+             && produced == part;
+    }
+    EVP_CIPHER_CTX_free(ctx);
+    return ok;
+}
+
+bool FileCipher::saveRuns() {
+    // Written before the ciphertext it describes, so a crash cannot leave bytes without their IV
+    QSaveFile ivFile(ivPath);
+    if (!ivFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        return false;
+    }
+    QTextStream stream(&ivFile);
+    for (const Run &run : runs) {
+        stream << run.start << " " << run.iv.toHex() << "\n";
+    }
+    stream.flush();
+    return ivFile.commit();
+}
+Looplagmonitor.h
+#ifndef LOOPLAGMONITOR_H
+#define LOOPLAGMONITOR_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QTimer>
+#include <atomic>
+#include <thread>
+#include <pthread.h>
+
+// Measures how late an event loop runs a 10 ms timer, which is how long everything else on
+// that thread (replies, timers, progress) was kept waiting. Samples go into DownloadMetrics.
+// A shared watchdog thread notices a loop that has not ticked for the threshold and signals
+// the stuck thread to record its own stack, so the report says what was blocking.
+class LoopLagMonitor : public QObject {
+    Q_OBJECT
+
+public:
+    // Watch the calling thread's event loop; the monitor goes away with the thread
+    static void install(const QString &loopName, int thresholdMsecs);
+    // Stop the watchdog and drop the calling thread's monitor; connect to aboutToQuit, so the
+    // teardown that follows is not reported as a stall
+    static void shutdown();
+    ~LoopLagMonitor();
+
+private slots:
+    void tick();
+
+private:
+    LoopLagMonitor(const QString &loopName, int thresholdMsecs);
+    static void watchdog();
+    static void stopWatchdog();
+    static void captureStack(int signal);  // Signal handler, runs on the stalled thread
+    static qint64 nowNsecs();
+
+    static const int tickMsecs = 10;
+    static const int maxFrames = 64;
+
+    static QMutex mutex;                      // Guards monitors
+    static QList<LoopLagMonitor *> monitors;
+    static void *frames[maxFrames];           // Filled by captureStack()
+    static std::atomic<int> frameCount;       // -1 until captureStack() has run
+    static std::thread watchdogThread;
+    static std::atomic<bool> stopping;
+
+    QString name;
+    int thresholdMsecs;
+    pthread_t thread;
+    QTimer timer;
+    QElapsedTimer sinceTick;
+    std::atomic<qint64> lastTickNsecs;
+    std::atomic<bool> stallReported;          // Once per stall, not once per watchdog pass
+};
+
+#endif // LOOPLAGMONITOR_H
+
+Looplagmonitor.cpp
+#include "looplagmonitor.h"
+#include "downloadmetrics.h"
+#include <QDebug>
+#include <QMutexLocker>
+#include <QThread>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <execinfo.h>
+#include <mutex>
+#include <thread>
+#include <time.h>
+
+QMutex LoopLagMonitor::mutex;
+QList<LoopLagMonitor *> LoopLagMonitor::monitors;
+void *LoopLagMonitor::frames[LoopLagMonitor::maxFrames];
+std::atomic<int> LoopLagMonitor::frameCount(-1);
+std::thread LoopLagMonitor::watchdogThread;
+std::atomic<bool> LoopLagMonitor::stopping(false);
+
+LoopLagMonitor::LoopLagMonitor(const QString &loopName, int threshold)
+    : name(loopName), thresholdMsecs(threshold), thread(pthread_self()), lastTickNsecs(nowNsecs()), stallReported(false) {
+    timer.setTimerType(Qt::PreciseTimer);
+    timer.setInterval(tickMsecs);
+    connect(&timer, &QTimer::timeout, this, &LoopLagMonitor::tick);
+    timer.start();
+    sinceTick.start();
+}
+
+LoopLagMonitor::~LoopLagMonitor() {
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    monitors.removeOne(this);
+}
+
+void LoopLagMonitor::install(const QString &loopName, int thresholdMsecs) {
+    static std::once_flag started;
+    std::call_once(started, []() {
+        void *warmUp[1];
+        backtrace(warmUp, 1);  // Loads the unwinder now, so the signal handler never has to
+        struct sigaction action = {};
+        action.sa_handler = captureStack;
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGUSR2, &action, nullptr);
+        watchdogThread = std::thread(watchdog);
+        std::atexit(stopWatchdog);  // Runs before the statics the watchdog reads are destroyed
+    });
+
+    LoopLagMonitor *monitor = new LoopLagMonitor(loopName, thresholdMsecs);
+    // Direct: unregistered on the thread itself, before it exits, so the watchdog never signals a dead thread
+    connect(QThread::currentThread(), &QThread::finished, monitor, [monitor]() {
+        QMutexLocker locker(&mutex);  // Ensure thread safety
+        monitors.removeOne(monitor);
+        monitor->deleteLater();
+    }, Qt::DirectConnection);
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    monitors.append(monitor);
+}
+
+void LoopLagMonitor::shutdown() {
+    stopWatchdog();
+    QList<LoopLagMonitor *> own;
+    {
+        QMutexLocker locker(&mutex);  // Ensure thread safety
+        for (int i = monitors.size() - 1; i >= 0; --i) {
+            if (pthread_equal(monitors[i]->thread, pthread_self())) {
+                own.append(monitors.takeAt(i));
+            }
+        }
+    }
+    qDeleteAll(own);  // Outside the lock: the destructor takes it
+}
+
+void LoopLagMonitor::stopWatchdog() {
+    stopping = true;
+    if (watchdogThread.joinable() && watchdogThread.get_id() != std::this_thread::get_id()) {
+        watchdogThread.join();
+    }
+}
+
+qint64 LoopLagMonitor::nowNsecs() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return qint64(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+void LoopLagMonitor::tick() {
+    qint64 lag = qMax<qint64>(0, sinceTick.restart() - tickMsecs);
+    DownloadMetrics::loopLag(name, lag);
+    lastTickNsecs = nowNsecs();
+    stallReported = false;
+}
+
+void LoopLagMonitor::captureStack(int) {
+    frameCount = backtrace(frames, maxFrames);
+}
+
+void LoopLagMonitor::watchdog() {
+    while (!stopping) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(tickMsecs));
+        QMutexLocker locker(&mutex);  // Ensure thread safety
+        for (LoopLagMonitor *monitor : monitors) {
+            qint64 stalledMsecs = (nowNsecs() - monitor->lastTickNsecs) / 1000000;
+            if (stalledMsecs < monitor->thresholdMsecs || monitor->stallReported) {
+                continue;
+            }
+            monitor->stallReported = true;
+
+            // One capture at a time: frames is shared, and this thread is the only one that signals
+            frameCount = -1;
+            pthread_kill(monitor->thread, SIGUSR2);
+            for (int waited = 0; frameCount < 0 && waited < 100; ++waited) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+
+            QString stack;
+            int count = frameCount;
+            if (count > 0) {
+                char **symbols = backtrace_symbols(frames, count);
+                for (int i = 1; i < count; ++i) {  // Frame 0 is captureStack() itself
+                    stack += QString("    %1\n").arg(QString::fromLocal8Bit(symbols[i]));
+                }
+                free(symbols);
+            }
+            qWarning().noquote() << "Event loop" << monitor->name << "stalled for" << stalledMsecs << "ms\n" + stack;
+            DownloadMetrics::loopStall(monitor->name, stalledMsecs, stack);
+        }
+    }
+}
+Zstdseekabledecoder.h
+#ifndef ZSTDSEEKABLEDECODER_H
+#define ZSTDSEEKABLEDECODER_H
+
+#include <QObject>
+#include <QNetworkAccessManager>
+#include <QReadWriteLock>
+#include <QString>
+#include <QVector>
+#include <atomic>
+
+// Decompresses a .zst download in the seekable format while it is still downloading. The seek
+// table at the end of the file is fetched first with suffix range requests; it gives every
+// frame's compressed and decompressed size, hence its input and output offsets. Each frame is
+// handed to the thread pool as soon as the download's contiguous offset passes its end, and
+// written straight to its place in a ".part" file, renamed over the output only once every frame
+// has decoded. A file not in the seekable format, or on a server without range support, is
+// skipped: it is still downloaded, just not decompressed.
+class ZstdSeekableDecoder : public QObject {
+    Q_OBJECT
+
+public:
+    // inputPath is where the download is being written; the output goes next to outputBase minus ".zst"
+    ZstdSeekableDecoder(QNetworkAccessManager *manager, const QString &url, const QString &inputPath,
+                        const QString &outputBase, QObject *parent = nullptr);
+    ~ZstdSeekableDecoder() override;
+    void start();
+
+public slots:
+    void inputAvailable(qint64 contiguousOffset);  // Connect to contiguousOffsetChanged
+    void inputFinished(const QString &filePath);   // Connect to downloadFinished; the file may have moved
+    void inputFailed();                            // Connect to downloadFailed
+
+signals:
+    void finished(const QString &outputPath, bool ok, const QString &error);
+    void skipped(const QString &outputPath, const QString &reason);  // Not decodable this way; the download itself is unaffected
+
+private:
+    struct Frame {
+        qint64 inputOffset = 0;
+        qint64 inputSize = 0;
+        qint64 outputOffset = 0;
+        qint64 outputSize = 0;
+        int generation = -1;  // Of the input the frame was last dispatched for; -1 if never
+        bool done = false;
+        bool failedEarly = false;  // Failed while the download was still running; retried once it ends
+        bool finalInput = false;   // Dispatched against the finished file, so a failure is final
+    };
+
+    void fetchTail(qint64 length);
+    bool parseSeekTable(const QByteArray &tail, qint64 fileSize);
+    void dispatch();
+    void frameDone(int index, int generation, const QString &error);
+    void finish(bool ok, const QString &error);
+    void skip(const QString &reason);
+
+    static const quint32 seekTableMagic = 0x8F92EAB1;
+    static const quint32 skippableMagic = 0x184D2A5E;
+    static const int footerSize = 9;
+    static const quint32 maxFrames = 1024 * 1024;              // Bounds the seek table fetched into memory
+    static const qint64 maxFrameBytes = 256 * 1024 * 1024;     // Each frame is decoded in memory on the pool
+
+    QNetworkAccessManager *networkManager;
+    QString url;
+    QString inputPath;
+    QString outputPath;
+    QString partPath;            // Frames are written here; an existing outputPath is left alone unless decoding succeeds
+    QVector<Frame> frames;
+    bool tableLoaded;
+    bool downloadDone;
+    bool ended;
+    qint64 available;            // Input bytes safe to read
+    int running;                 // Frames on the thread pool
+    int framesDone;
+    std::atomic<int> generation; // Bumped when the input is rewritten under us
+    QReadWriteLock writeLock;    // Held for writing while generation changes, for reading around frame writes
+};
+
+#endif // ZSTDSEEKABLEDECODER_H
+
+Zstdseekabledecoder.cpp
+#include "zstdseekabledecoder.h"
+#include <QFile>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QtEndian>
+#include <cstdio>
+#include <functional>
+#include <zstd.h>
+
+namespace {
+class FrameTask : public QRunnable {
+public:
+    FrameTask(std::function<void()> work) : work(std::move(work)) {}
+    void run() override { work(); }
+
+private:
+    std::function<void()> work;
+};
+}
+
+ZstdSeekableDecoder::ZstdSeekableDecoder(QNetworkAccessManager *manager, const QString &url, const QString &inputPath,
+                                         const QString &outputBase, QObject *parent)
+    : QObject(parent), networkManager(manager), url(url), inputPath(inputPath), tableLoaded(false), downloadDone(false),
+      ended(false), available(0), running(0), framesDone(0), generation(0) {
+    outputPath = outputBase.endsWith(".zst") ? outputBase.chopped(4) : outputBase + ".out";
+    partPath = outputPath + ".part";
+}
+
+ZstdSeekableDecoder::~ZstdSeekableDecoder() {
+    QFile::remove(partPath);  // Only left behind by a failed or skipped decode; no task is running by now
+}
+
+void ZstdSeekableDecoder::start() {
+    fetchTail(footerSize);
+}
+
+void ZstdSeekableDecoder::fetchTail(qint64 length) {
+    QNetworkRequest request{QUrl(url)};
+    request.setAttribute(QNetworkRequest::RedirectPolicyAttribute, QNetworkRequest::NoLessSafeRedirectPolicy);
+    request.setRawHeader("Range", "bytes=-" + QByteArray::number(length));
+    QNetworkReply *reply = networkManager->get(request);
+    connect(reply, &QNetworkReply::metaDataChanged, this, [reply]() {
+        if (reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 200) {
+            reply->abort();  // The range was ignored: this is the whole file, and the download fetches it anyway
+        }
+    });
+    connect(reply, &QNetworkReply::finished, this, [this, reply, length]() {
+        reply->deleteLater();
+        QByteArray tail = reply->readAll();
+        // "bytes <first>-<last>/<size>"
+        qint64 fileSize = reply->rawHeader("Content-Range").split('/').value(1).toLongLong();
+        int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        if (status == 200 || status == 416) {
+            skip("server cannot serve the seek table by range");
+            return;
+        }
+        if (reply->error() != QNetworkReply::NoError || status != 206 || tail.size() != length || fileSize <= 0) {
+            finish(false, "cannot fetch the seek table: " + reply->errorString());
+            return;
+        }
+
+        if (length == footerSize) {
+            if (qFromLittleEndian<quint32>(tail.constData() + 5) != seekTableMagic) {
+                skip("not in the seekable zstd format");
+                return;
+            }
+            quint32 frameCount = qFromLittleEndian<quint32>(tail.constData());
+            if (frameCount > maxFrames) {
+                finish(false, "seek table too large");
+                return;
+            }
+            int entrySize = (tail[4] & 0x80) ? 12 : 8;  // Entries carry a checksum when bit 7 is set
+            fetchTail(8 + qint64(frameCount) * entrySize + footerSize);  // Skippable frame header, entries, footer
+            return;
+        }
+        if (!parseSeekTable(tail, fileSize)) {
+            finish(false, "malformed seek table");
+            return;
+        }
+
+        QFile output(partPath);
+        qint64 outputSize = frames.isEmpty() ? 0 : frames.last().outputOffset + frames.last().outputSize;
+        if (!output.open(QIODevice::WriteOnly) || !output.resize(outputSize)) {
+            finish(false, "cannot create " + partPath);
+            return;
+        }
+        tableLoaded = true;
+        dispatch();
+    });
+}
+
+bool ZstdSeekableDecoder::parseSeekTable(const QByteArray &tail, qint64 fileSize) {
+    const char *data = tail.constData();
+    if (qFromLittleEndian<quint32>(data) != skippableMagic
+        || qFromLittleEndian<quint32>(data + 4) != quint32(tail.size() - 8)) {
+        return false;
+    }
+    quint32 frameCount = qFromLittleEndian<quint32>(data + tail.size() - footerSize);
+    int entrySize = (data[tail.size() - 5] & 0x80) ? 12 : 8;
+
+    qint64 inputOffset = 0, outputOffset = 0;
+    for (quint32 i = 0; i < frameCount; ++i) {
+        const char *entry = data + 8 + qint64(i) * entrySize;
+        Frame frame;
+        frame.inputOffset = inputOffset;
+        frame.inputSize = qFromLittleEndian<quint32>(entry);
+        frame.outputOffset = outputOffset;
+        frame.outputSize = qFromLittleEndian<quint32>(entry + 4);
+        if (frame.inputSize > maxFrameBytes || frame.outputSize > maxFrameBytes) {
+            return false;  // Not a sane seekable file, and would not fit a QByteArray on the pool anyway
+        }
+        inputOffset += frame.inputSize;
+        outputOffset += frame.outputSize;
+        frames.append(frame);
+    }
+    return inputOffset + tail.size() == fileSize;  // Frames then the seek table, nothing else
+}
+
+void ZstdSeekableDecoder::inputAvailable(qint64 contiguousOffset) {
+    if (contiguousOffset < available) {
+        // The downloader went back and rewrote part of the file: anything decoded from it is suspect
+        QWriteLocker locker(&writeLock);
+        generation++;
+        for (Frame &frame : frames) {
+            if (frame.inputOffset + frame.inputSize > contiguousOffset && frame.done) {
+                frame.done = false;
+                framesDone--;
+            }
+        }
+    }
+    available = contiguousOffset;
+    dispatch();
+}
+
+void ZstdSeekableDecoder::inputFinished(const QString &filePath) {
+    inputPath = filePath;
+    downloadDone = true;
+    available = QFile(inputPath).size();
+    for (Frame &frame : frames) {
+        if (frame.failedEarly) {
+            frame.failedEarly = false;
+            frame.generation = -1;
+        }
+    }
+    dispatch();
+}
+
+void ZstdSeekableDecoder::inputFailed() {
+    skip("download failed");  // Already counted as a failure by the download
+}
+
+void ZstdSeekableDecoder::dispatch() {
+    if (!tableLoaded || ended) {
+        return;
+    }
+    int current = generation;
+    for (int i = 0; i < frames.size(); ++i) {
+        Frame &frame = frames[i];
+        if (frame.done || frame.generation == current || frame.inputOffset + frame.inputSize > available) {
+            continue;
+        }
+        frame.generation = current;
+        frame.finalInput = downloadDone;
+        running++;
+        Frame job = frame;
+        QString source = inputPath;
+        QThreadPool::globalInstance()->start(new FrameTask([this, i, job, current, source]() {
+            QString error;
+            QFile input(source);
+            QByteArray compressed;
+            if (input.open(QIODevice::ReadOnly) && input.seek(job.inputOffset)) {
+                compressed = input.read(job.inputSize);
+            }
+            QByteArray decompressed(int(job.outputSize), Qt::Uninitialized);  // parseSeekTable() capped the size
+            // A context per call, freed with it: a thread_local one would outlive the decoder on pool threads
+            size_t result = ZSTD_decompress(decompressed.data(), decompressed.size(),
+                                            compressed.constData(), compressed.size());
+            if (compressed.size() != job.inputSize) {
+                error = "cannot read frame";
+            } else if (ZSTD_isError(result) || qint64(result) != job.outputSize) {
+                error = QString("frame %1: %2").arg(i).arg(ZSTD_isError(result) ? ZSTD_getErrorName(result) : "wrong size");
+            } else {
+                // Skipped if the input changed while this frame was decoding; it will be redone
+                QReadLocker locker(&writeLock);
+                if (generation == current) {
+                    QFile output(partPath);
+                    if (!output.open(QIODevice::ReadWrite) || !output.seek(job.outputOffset)
+                        || output.write(decompressed) != decompressed.size()) {
+                        error = "cannot write " + partPath;
+                    }
+                }
+            }
+            QMetaObject::invokeMethod(this, [this, i, current, error]() { frameDone(i, current, error); });
+        }));
+    }
+
+    if (downloadDone && framesDone == frames.size() && running == 0) {
+        finish(true, QString());
+    }
+}
+
+void ZstdSeekableDecoder::frameDone(int index, int frameGeneration, const QString &error) {
+    running--;
+    if (frameGeneration == generation && !frames[index].done) {
+        if (!error.isEmpty()) {
+            // A bad frame in data the downloader is still writing may just be a rewrite in
+            // progress; only a finished download makes it final
+            if (frames[index].finalInput) {
+                finish(false, error);
+                return;
+            }
+            if (downloadDone) {
+                frames[index].generation = -1;  // Read before the file was moved; retry at its final path
+            } else {
+                frames[index].failedEarly = true;
+            }
+        } else {
+            frames[index].done = true;
+            framesDone++;
+        }
+    }
+    if (ended && running == 0) {
+        deleteLater();
+        return;
+    }
+    dispatch();
+}
+
+void ZstdSeekableDecoder::finish(bool ok, const QString &error) {
+    if (ended) {
+        return;
+    }
+    ended = true;
+    // Only called with ok once every frame is done and none is running, so the part file is complete
+    if (ok && ::rename(QFile::encodeName(partPath).constData(), QFile::encodeName(outputPath).constData()) != 0) {
+        emit finished(outputPath, false, "cannot rename " + partPath + " to " + outputPath);
+    } else {
+        emit finished(outputPath, ok, error);
+    }
+    if (running == 0) {
+        deleteLater();  // Otherwise the last frameDone() does it, so no task outlives this object
+    }
+}
+
+void ZstdSeekableDecoder::skip(const QString &reason) {
+    if (ended) {
+        return;
+    }
+    ended = true;
+    emit skipped(outputPath, reason);
+    if (running == 0) {
+        deleteLater();
+    }
+}
+Stagingmover.h
+#ifndef STAGINGMOVER_H
+#define STAGINGMOVER_H
+
+#include <QObject>
+#include <QMutex>
+#include <QQueue>
+#include <QString>
+#include <QThread>
+#include <QTimer>
+#include <atomic>
+#include <functional>
+
+// Two storage tiers: downloads are written to a fast scratch directory and moved to their
+// final path when complete, one file at a time in large sequential writes, so slow bulk
+// storage never sees the scattered writes of many concurrent downloads. Scratch has a byte
+// budget; while it is over, no new transfer starts and running ones stop reading from the
+// network until the mover catches up. The bulk tier keeps a reserve of free space the mover
+// will not eat into.
+class StagingMover : public QObject {
+    Q_OBJECT
+
+public:
+    using Done = std::function<void(const QString &finalPath, const QString &error)>;
+
+    static void configure(const QString &scratchDir, qint64 scratchBudgetBytes, qint64 bulkReserveBytes);
+    static void shutdown();
+    static QString stagedPath(const QString &finalPath);
+    static int admissionDelayMsecs();  // How long to wait before checking again; 0 while scratch has room
+    static qint64 scratchBudgetBytes() { return scratchBudget; }  // 0 when unlimited
+    static qint64 bulkReserveBytes() { return bulkReserve; }
+
+    // Thread-safe; done runs on receiver's thread
+    static void migrate(const QString &stagedPath, const QString &finalPath, QObject *receiver, Done done);
+
+private slots:
+    void refreshUsage();
+    void moveNext();
+
+private:
+    struct Move {
+        QString stagedPath;
+        QString finalPath;
+        QObject *receiver = nullptr;
+        Done done;
+    };
+
+    StagingMover();
+    ~StagingMover();
+    QString moveFile(const QString &from, const QString &to);  // Returns an error, empty on success
+    static void notify(const Move &move, const QString &error);  // Runs move.done on its receiver's thread
+
+    static const int usageRefreshMsecs = 500;
+    static const int reserveRetryMsecs = 5000;
+    static const int admissionDelay = 200;
+    static const qint64 copyChunkBytes = 8 * 1024 * 1024;
+
+    static StagingMover *self;
+    static QString scratchDir;
+    static qint64 scratchBudget;
+    static qint64 bulkReserve;
+
+    QThread worker;
+    QTimer *usageTimer;
+    QMutex mutex;                   // Guards moves, moving and waitingForSpace
+    QQueue<Move> moves;
+    bool moving;
+    bool waitingForSpace;           // Warned already; quiet until a move goes through again
+    bool retryScheduled;            // Worker thread only
+    std::atomic<qint64> scratchUsed;
+};
+
+#endif // STAGINGMOVER_H
+
+Stagingmover.cpp
+#include "stagingmover.h"
+#include "filecipher.h"
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QPointer>
+#include <QSaveFile>
+#include <QStorageInfo>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+StagingMover *StagingMover::self = nullptr;
+QString StagingMover::scratchDir;
+qint64 StagingMover::scratchBudget = 0;
+qint64 StagingMover::bulkReserve = 0;
+
+StagingMover::StagingMover()
+    : usageTimer(nullptr), moving(false), waitingForSpace(false), retryScheduled(false), scratchUsed(0) {
+    moveToThread(&worker);
+    worker.start();
+    QMetaObject::invokeMethod(this, [this]() {
+        usageTimer = new QTimer(this);
+        connect(usageTimer, &QTimer::timeout, this, &StagingMover::refreshUsage);
+        usageTimer->start(usageRefreshMsecs);
+        refreshUsage();
+    });
+}
+
+StagingMover::~StagingMover() {
+    // The usage timer belongs to the worker thread and is destroyed there; a move in progress finishes first
+    QMetaObject::invokeMethod(this, [this]() {
+        const QObjectList owned = children();
+        qDeleteAll(owned);
+    }, Qt::BlockingQueuedConnection);
+    worker.quit();
+    worker.wait();
+}
+
+void StagingMover::configure(const QString &dir, qint64 scratchBudgetBytes, qint64 bulkReserveBytes) {
+    scratchDir = dir;
+    scratchBudget = scratchBudgetBytes;
+    bulkReserve = bulkReserveBytes;
+    QDir().mkpath(scratchDir);
+    if (!self) {
+        self = new StagingMover();
+    }
+}
+
+void StagingMover::shutdown() {
+    delete self;
+    self = nullptr;
+}
+
+QString StagingMover::stagedPath(const QString &finalPath) {
+    // Unique per final path, and still recognisable when listing the scratch directory
+    QByteArray key = QCryptographicHash::hash(QFileInfo(finalPath).absoluteFilePath().toUtf8(), QCryptographicHash::Sha1);
+    return scratchDir + "/" + key.toHex().left(16) + "-" + QFileInfo(finalPath).fileName();
+}
+
+int StagingMover::admissionDelayMsecs() {
+    return self && scratchBudget > 0 && self->scratchUsed >= scratchBudget ? admissionDelay : 0;
+}
+
+void StagingMover::refreshUsage() {
+    qint64 used = 0;
+    for (const QFileInfo &entry : QDir(scratchDir).entryInfoList(QDir::Files)) {
+        used += entry.size();
+    }
+    scratchUsed = used;
+}
+
+void StagingMover::migrate(const QString &stagedPath, const QString &finalPath, QObject *receiver, Done done) {
+    Move move;
+    move.stagedPath = stagedPath;
+    move.finalPath = finalPath;
+    move.receiver = receiver;
+    move.done = done;
+    {
+        QMutexLocker locker(&self->mutex);  // Ensure thread safety
+        self->moves.enqueue(move);
+    }
+    QMetaObject::invokeMethod(self, "moveNext", Qt::QueuedConnection);
+}
+
+void StagingMover::moveNext() {
+    QList<Move> pending;
+    {
+        QMutexLocker locker(&mutex);  // Ensure thread safety
+        if (moving || moves.isEmpty()) {
+            return;
+        }
+        moving = true;  // Claims the queue while it is checked below with no lock held
+        pending = moves;
+    }
+
+    // Take the first move the bulk tier has room for: one waiting for space does not hold up
+    // moves to other volumes or smaller files, and one that can never fit fails now
+    QByteArray scratchDevice = QStorageInfo(scratchDir).device();
+    int chosen = -1;
+    QList<Move> tooLarge;
+    for (int i = 0; i < pending.size() && chosen < 0; ++i) {
+        const Move &candidate = pending[i];
+        QString finalDir = QFileInfo(candidate.finalPath).absolutePath();
+        QDir().mkpath(finalDir);
+        QStorageInfo bulk(finalDir);
+        qint64 size = QFileInfo(candidate.stagedPath).size();
+        if (!bulk.isValid() || bulk.device() == scratchDevice) {
+            chosen = i;  // A rename, which needs no space
+        } else if (size > bulk.bytesTotal() - bulkReserve) {
+            tooLarge.append(candidate);
+        } else if (bulk.bytesAvailable() - size >= bulkReserve) {
+            chosen = i;
+        }
+    }
+
+    Move move;
+    {
+        QMutexLocker locker(&mutex);  // Ensure thread safety
+        for (int i = moves.size() - 1; i >= 0; --i) {
+            bool failed = std::any_of(tooLarge.cbegin(), tooLarge.cend(),
+                                      [&](const Move &m) { return m.stagedPath == moves[i].stagedPath; });
+            if (failed) {
+                moves.removeAt(i);
+            } else if (chosen >= 0 && moves[i].stagedPath == pending[chosen].stagedPath) {
+                move = moves.takeAt(i);
+            }
+        }
+        if (chosen < 0) {
+            // Waiting keeps the files, and their scratch budget, in place until the bulk tier has room
+            moving = false;
+            if (!moves.isEmpty() && !waitingForSpace) {
+                qWarning().noquote() << "Staging: waiting for space on the bulk tier for" << moves.size() << "file(s)";
+            }
+            waitingForSpace = !moves.isEmpty();
+            if (waitingForSpace && !retryScheduled) {
+                retryScheduled = true;
+                QTimer::singleShot(reserveRetryMsecs, this, [this]() {
+                    retryScheduled = false;
+                    moveNext();
+                });
+            }
+        } else {
+            waitingForSpace = false;
+        }
+    }
+    for (const Move &failed : tooLarge) {
+        notify(failed, QString("Cannot move %1 to %2: larger than the volume's space above the bulk reserve")
+                           .arg(failed.stagedPath, failed.finalPath));
+    }
+    if (chosen < 0) {
+        return;
+    }
+
+    QString error = moveFile(move.stagedPath, move.finalPath);
+    if (error.isEmpty() && QFile::exists(FileCipher::ivFilePath(move.stagedPath))) {
+        error = moveFile(FileCipher::ivFilePath(move.stagedPath), FileCipher::ivFilePath(move.finalPath));
+    }
+    refreshUsage();
+    notify(move, error);
+
+    QMutexLocker locker(&mutex);  // Ensure thread safety
+    moving = false;
+    QMetaObject::invokeMethod(this, "moveNext", Qt::QueuedConnection);
+}
+
+void StagingMover::notify(const Move &move, const QString &error) {
+    Done done = move.done;
+    QString finalPath = move.finalPath;
+    QPointer<QObject> receiver = move.receiver;
+    if (receiver) {
+        QMetaObject::invokeMethod(receiver, [done, finalPath, error]() { done(finalPath, error); });
+    }
+}
+
+QString StagingMover::moveFile(const QString &from, const QString &to) {
+    if (::rename(QFile::encodeName(from).constData(), QFile::encodeName(to).constData()) == 0) {
+        return QString();  // Same filesystem after all
+    }
+    if (errno != EXDEV) {
+        return QString("Cannot move %1 to %2: %3").arg(from, to, qt_error_string(errno));
+    }
+
+    // Across tiers: one sequential pass, written aside and renamed into place when durable
+    QFile source(from);
+    QSaveFile target(to);
+    if (!source.open(QIODevice::ReadOnly) || !target.open(QIODevice::WriteOnly)) {
+        return QString("Cannot move %1 to %2").arg(from, to);
+    }
+    posix_fadvise(source.handle(), 0, 0, POSIX_FADV_SEQUENTIAL);
+    QByteArray chunk;
+    while (!(chunk = source.read(copyChunkBytes)).isEmpty()) {
+        if (target.write(chunk) != chunk.size()) {
+            target.cancelWriting();
+            return QString("Cannot write %1: %2").arg(to, target.errorString());
+        }
+    }
+    target.flush();
+    fdatasync(target.handle());
+    if (!target.commit()) {
+        return QString("Cannot write %1: %2").arg(to, target.errorString());
+    }
+    source.remove();
+    return QString();
+}
+Jobcoordinator.h
+#ifndef JOBCOORDINATOR_H
+#define JOBCOORDINATOR_H
+
+#include <QObject>
+#include <QHash>
+#include <QQueue>
+#include <QHostAddress>
+#include <QStringList>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+
+// Owns a batch and leases its jobs to JobWorker instances on other machines (or other
+// processes on this one). Line protocol over TCP; on connect the coordinator sends
+// CHALLENGE <nonce>, then worker to coordinator:
+//   HELLO <name> <proof> / LEASE <count> / HEARTBEAT
+//   RESULT <id> <epoch> OK <path> / RESULT <id> <epoch> FAIL <error>
+// and back: JOB <id> <epoch> <url> / WAIT / DONE. The proof is the hex HMAC-SHA256 of the
+// nonce under the shared secret ("-" when there is none). The epoch is random per batch, so
+// a result a worker kept from an earlier run cannot end a job of this one with the same id.
+// A lease lives as long as its worker keeps sending heartbeats; when it expires the job goes
+// back on the queue for someone else.
+class JobCoordinator : public QObject {
+    Q_OBJECT
+
+public:
+    explicit JobCoordinator(QObject *parent = nullptr);
+    void setSecret(const QByteArray &secret);  // Workers must prove they hold it; empty accepts anyone
+    bool listen(quint16 port, const QHostAddress &address = QHostAddress::LocalHost);
+    void addJobs(const QStringList &urls);
+
+    static QByteArray proof(const QByteArray &secret, const QByteArray &nonce);  // What HELLO carries
+
+signals:
+    void jobEnded(const QString &url, bool failed, const QString &detail);  // Once per job
+
+private slots:
+    void onConnection();
+    void expireLeases();
+
+private:
+    struct Job {
+        QString url;
+        int attempts = 0;
+        QString worker;        // Holder of the current lease, empty while queued
+        qint64 leaseExpiry = 0;
+        bool ended = false;
+    };
+
+    void onLine(QTcpSocket *socket, const QByteArray &line);
+    void requeue(quint64 id, const QString &reason);
+
+    static const int leaseMsecs = 10000;  // Three missed heartbeats and a bit
+    static const int maxAttempts = 3;
+
+    QTcpServer server;
+    QTimer expiryTimer;
+    QHash<quint64, Job> jobs;
+    QQueue<quint64> queue;
+    QHash<QTcpSocket *, QString> workerNames;
+    QHash<QTcpSocket *, QByteArray> nonces;  // Challenge sent to each connection not yet past HELLO
+    QByteArray secret;
+    QByteArray epoch;      // Batch token in JOB and RESULT lines
+    quint64 nextId;
+    int remaining;         // Jobs not ended yet
+};
+
+#endif // JOBCOORDINATOR_H
+
+Jobcoordinator.cpp
+#include "jobcoordinator.h"
+#include <QDateTime>
+#include <QDebug>
+#include <QMessageAuthenticationCode>
+#include <QRandomGenerator>
+
+JobCoordinator::JobCoordinator(QObject *parent)
+    : QObject(parent), epoch(QByteArray::number(QRandomGenerator::system()->generate64(), 16)), nextId(1), remaining(0) {
+    connect(&server, &QTcpServer::newConnection, this, &JobCoordinator::onConnection);
+    connect(&expiryTimer, &QTimer::timeout, this, &JobCoordinator::expireLeases);
+    expiryTimer.start(1000);
+}
+
+void JobCoordinator::setSecret(const QByteArray &value) {
+    secret = value;
+}
+
+bool JobCoordinator::listen(quint16 port, const QHostAddress &address) {
+    if (secret.isEmpty() && !address.isLoopback()) {
+        qWarning() << "Coordinator: listening on" << address.toString() << "without a shared secret; any host can take jobs";
+    }
+    return server.listen(address, port);
+}
+
+QByteArray JobCoordinator::proof(const QByteArray &secret, const QByteArray &nonce) {
+    if (secret.isEmpty()) {
+        return "-";
+    }
+    return QMessageAuthenticationCode::hash(nonce, secret, QCryptographicHash::Sha256).toHex();
+}
+
+void JobCoordinator::addJobs(const QStringList &urls) {
+    for (const QString &url : urls) {
+        Job job;
+        job.url = url;
+        jobs.insert(nextId, job);
+        queue.enqueue(nextId++);
+        remaining++;
+    }
+}
+
+void JobCoordinator::onConnection() {
+    while (QTcpSocket *socket = server.nextPendingConnection()) {
+        QByteArray nonce(16, Qt::Uninitialized);
+        QRandomGenerator::system()->fillRange(reinterpret_cast<quint32 *>(nonce.data()), 4);
+        nonces.insert(socket, nonce.toHex());
+        socket->write("CHALLENGE " + nonce.toHex() + "\n");
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket]() {
+            while (socket->canReadLine()) {
+                onLine(socket, socket->readLine().trimmed());
+            }
+        });
+        connect(socket, &QTcpSocket::disconnected, this, [this, socket]() {
+            // Its leases are left to expire: the worker may reconnect and report them yet
+            workerNames.remove(socket);
+            nonces.remove(socket);
+            socket->deleteLater();
+        });
+    }
+}
+
+void JobCoordinator::onLine(QTcpSocket *socket, const QByteArray &line) {
+    QList<QByteArray> fields = line.split(' ');
+    const QByteArray &command = fields[0];
+    QString worker = workerNames.value(socket);
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    if (command == "HELLO" && fields.size() >= 3 && worker.isEmpty()) {
+        QByteArray expected = proof(secret, nonces.value(socket));
+        if (!secret.isEmpty() && fields[2] != expected) {
+            qWarning().noquote() << "Coordinator: rejected" << socket->peerAddress().toString() << "(wrong secret)";
+            socket->write("ERR wrong secret\n");
+            socket->disconnectFromHost();
+            return;
+        }
+        nonces.remove(socket);
+        workerNames.insert(socket, QString::fromUtf8(fields[1]));
+        socket->write("OK\n");
+    } else if (worker.isEmpty()) {
+        socket->write("ERR say HELLO first\n");
+    } else if (command == "HEARTBEAT") {
+        for (Job &job : jobs) {
+            if (job.worker == worker && !job.ended) {
+                job.leaseExpiry = now + leaseMsecs;
+            }
+        }
+    } else if (command == "LEASE" && fields.size() >= 2) {
+        int wanted = fields[1].toInt();
+        QByteArray reply;
+        while (wanted-- > 0 && !queue.isEmpty()) {
+            quint64 id = queue.dequeue();
+            Job &job = jobs[id];
+            job.worker = worker;
+            job.leaseExpiry = now + leaseMsecs;
+            job.attempts++;
+            reply += "JOB " + QByteArray::number(id) + " " + epoch + " " + job.url.toUtf8() + "\n";
+        }
+        if (reply.isEmpty()) {
+            reply = remaining == 0 ? "DONE\n" : "WAIT\n";  // WAIT: others hold leases that may yet come back
+        }
+        socket->write(reply);
+    } else if (command == "RESULT" && fields.size() >= 4) {
+        if (fields[2] != epoch) {
+            return;  // Kept by the worker from an earlier batch; its id means another job here
+        }
+        quint64 id = fields[1].toULongLong();
+        auto it = jobs.find(id);
+        if (it == jobs.end() || it->ended) {
+            return;  // A late duplicate from a lease that expired and was handed out again
+        }
+        QString detail = QString::fromUtf8(fields.mid(4).join(' '));
+        if (fields[3] == "OK") {
+            it->ended = true;
+            remaining--;
+            queue.removeAll(id);  // Reported by the old holder after the job was requeued
+            qInfo().noquote() << "Coordinator:" << it->url << "done by" << worker << "->" << detail;
+            emit jobEnded(it->url, false, worker + ": " + detail);
+        } else if (it->worker == worker) {
+            requeue(id, worker + ": " + detail);
+        }
+    } else {
+        socket->write("ERR\n");
+    }
+}
+
+void JobCoordinator::expireLeases() {
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for (auto it = jobs.begin(); it != jobs.end(); ++it) {
+        if (!it->ended && !it->worker.isEmpty() && it->leaseExpiry < now) {
+            requeue(it.key(), "lease held by " + it->worker + " expired");
+        }
+    }
+}
+
+void JobCoordinator::requeue(quint64 id, const QString &reason) {
+    Job &job = jobs[id];
+    job.worker.clear();
+    if (job.attempts >= maxAttempts) {
+        job.ended = true;
+        remaining--;
+        qWarning().noquote() << "Coordinator:" << job.url << "failed:" << reason;
+        emit jobEnded(job.url, true, reason);
+        return;
+    }
+    qWarning().noquote() << "Coordinator: retrying" << job.url << "after" << reason;
+    queue.enqueue(id);
+}
+
+Jobworker.h
+#ifndef JOBWORKER_H
+#define JOBWORKER_H
+
+#include <QObject>
+#include <QHash>
+#include <QStringList>
+#include <QTcpSocket>
+#include <QTimer>
+#include "downloadqueue.h"
+
+// The other end of JobCoordinator: leases up to `capacity` jobs at a time, runs them on the
+// local DownloadQueue, heartbeats while they run and reports each result. Reconnects if the
+// coordinator goes away, keeping results to report once it is back.
+class JobWorker : public QObject {
+    Q_OBJECT
+
+public:
+    JobWorker(const QString &host, quint16 port, DownloadQueue *queue, int capacity, QObject *parent = nullptr);
+    void setSecret(const QByteArray &secret);  // The coordinator's shared secret, if it has one
+    void start();
+
+signals:
+    void batchDone(int failed);  // The coordinator has no more work and our jobs have ended
+
+private:
+    void onLine(const QByteArray &line);
+    void onResults(const QVector<DownloadQueue::JobResult> &results, bool failed);
+    void requestLeases();
+
+    static const int heartbeatMsecs = 3000;
+    static const int retryMsecs = 1000;
+    const QString clientId;  // DownloadQueue client the leased jobs run under: one per coordinator
+
+    QString host;
+    quint16 port;
+    DownloadQueue *queue;
+    int capacity;
+    QString name;
+    QTcpSocket socket;
+    QTimer heartbeat;
+    QByteArray secret;
+    QHash<quint64, QByteArray> coordinatorIds;  // Local queue id -> "<job id> <epoch>" as the coordinator sent it
+    QStringList unsent;                      // RESULT lines waiting for a connection
+    bool leaseRequested;
+    bool coordinatorDone;
+    int failedJobs;
+};
+
+#endif // JOBWORKER_H
+
+Jobworker.cpp
+#include "jobworker.h"
+#include "jobcoordinator.h"
+#include <QCoreApplication>
+#include <QHostInfo>
+
+JobWorker::JobWorker(const QString &host, quint16 port, DownloadQueue *queue, int capacity, QObject *parent)
+    : QObject(parent), clientId("coordinator " + host + ":" + QString::number(port)), host(host), port(port), queue(queue),
+      capacity(qMax(1, capacity)),
+      name(QHostInfo::localHostName() + "-" + QString::number(QCoreApplication::applicationPid())),
+      leaseRequested(false), coordinatorDone(false), failedJobs(0) {
+    connect(&socket, &QTcpSocket::connected, this, [this]() {
+        leaseRequested = true;  // Nothing is sent before the coordinator's CHALLENGE
+    });
+    connect(&socket, &QTcpSocket::readyRead, this, [this]() {
+        while (socket.canReadLine()) {
+            onLine(socket.readLine().trimmed());
+        }
+    });
+    connect(&socket, &QTcpSocket::disconnected, this, [this]() {
+        if (!coordinatorDone) {
+            QTimer::singleShot(retryMsecs, this, [this]() { socket.connectToHost(this->host, this->port); });
+        }
+    });
+    connect(&socket, &QAbstractSocket::errorOccurred, this, [this](QAbstractSocket::SocketError) {
+        if (socket.state() == QAbstractSocket::UnconnectedState && !coordinatorDone) {
+            QTimer::singleShot(retryMsecs, this, [this]() { socket.connectToHost(this->host, this->port); });
+        }
+    });
+    connect(&heartbeat, &QTimer::timeout, this, [this]() {
+        if (socket.state() == QAbstractSocket::ConnectedState) {
+            socket.write("HEARTBEAT\n");
+        }
+    });
+    connect(queue, &DownloadQueue::jobsFinished, this, [this](const QVector<DownloadQueue::JobResult> &results) {
+        onResults(results, false);
+    });
+    connect(queue, &DownloadQueue::jobsFailed, this, [this](const QVector<DownloadQueue::JobResult> &results) {
+        onResults(results, true);
+    });
+}
+
+void JobWorker::setSecret(const QByteArray &value) {
+    secret = value;
+}
+
+void JobWorker::start() {
+    heartbeat.start(heartbeatMsecs);
+    socket.connectToHost(host, port);
+}
+
+void JobWorker::requestLeases() {
+    int free = capacity - coordinatorIds.size();
+    if (leaseRequested || free <= 0 || coordinatorDone || socket.state() != QAbstractSocket::ConnectedState) {
+        return;
+    }
+    leaseRequested = true;
+    socket.write("LEASE " + QByteArray::number(free) + "\n");
+}
+
+void JobWorker::onLine(const QByteArray &line) {
+    if (line.startsWith("CHALLENGE ")) {
+        QByteArray pending = "HELLO " + name.toUtf8() + " " + JobCoordinator::proof(secret, line.mid(10)) + "\n";
+        for (const QString &result : unsent) {
+            pending += result.toUtf8() + "\n";
+        }
+        unsent.clear();
+        socket.write(pending);
+        leaseRequested = false;
+        requestLeases();
+    } else if (line.startsWith("ERR wrong secret")) {
+        qCritical() << "Coordinator at" << host << "rejected our secret";
+        coordinatorDone = true;  // Retrying cannot help
+        socket.disconnectFromHost();
+        emit batchDone(qMax(1, failedJobs + coordinatorIds.size()));
+    } else if (line.startsWith("JOB ")) {
+        QList<QByteArray> fields = line.split(' ');
+        quint64 localId = queue->submit(QStringList() << QString::fromUtf8(fields.mid(3).join(' ')), clientId);
+        coordinatorIds.insert(localId, fields[1] + " " + fields[2]);
+        leaseRequested = false;  // Every JOB line of one answer arrives together
+        QTimer::singleShot(0, this, &JobWorker::requestLeases);
+    } else if (line == "WAIT") {
+        leaseRequested = false;
+        QTimer::singleShot(retryMsecs, this, &JobWorker::requestLeases);
+    } else if (line == "DONE") {
+        leaseRequested = false;
+        coordinatorDone = true;
+        if (coordinatorIds.isEmpty()) {
+            emit batchDone(failedJobs);
+        }
+    }
+}
+
+void JobWorker::onResults(const QVector<DownloadQueue::JobResult> &results, bool failed) {
+    for (const DownloadQueue::JobResult &result : results) {
+        if (result.clientId != clientId || !coordinatorIds.contains(result.id)) {
+            continue;  // A local job, not one of ours
+        }
+        QByteArray token = coordinatorIds.take(result.id);
+        QString line = QString("RESULT %1 %2 %3").arg(QString::fromLatin1(token)).arg(failed ? "FAIL" : "OK").arg(failed ? result.error : result.filePath);
+        line.replace('\n', ' ');
+        if (failed) {
+            failedJobs++;
+        }
+        if (socket.state() == QAbstractSocket::ConnectedState) {
+            socket.write(line.toUtf8() + "\n");
+        } else {
+            unsent.append(line);
+        }
+    }
+    if (coordinatorDone && coordinatorIds.isEmpty()) {
+        emit batchDone(failedJobs);
+        return;
+    }
+    requestLeases();
+}
+
+Main.cpp
+#include "downloadthread.h"
+#include "downloadmetrics.h"
+#include "preflightprober.h"
+#include "indexcrawler.h"
+#include "downloadqueue.h"
+#include "bindingnetworkaccessmanager.h"
+#include "sourceaddresspool.h"
+#include "peercache.h"
+#include "proxyserver.h"
+#include "numaplacement.h"
+#include "filecipher.h"
+#include "looplagmonitor.h"
+#include "zstdseekabledecoder.h"
+#include "stagingmover.h"
+#include "jobcoordinator.h"
+#include "jobworker.h"
+#include <QApplication>
+#include <QPushButton>
+#include <QVBoxLayout>
+#include <QWidget>
+#include <QProgressBar>
+#include <QLineEdit>
+#include <QLabel>
+#include <QNetworkAccessManager>
+#include <QDir>
+#include <QFile>
+#include <QTextStream>
+#include <QMutexLocker>
+#include <QStringList>
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QNetworkDiskCache>
+#include <QStandardPaths>
+#include <QStorageInfo>
+#include <QFileInfo>
+#include <QHash>
+#include <QSharedPointer>
+#include <QTimer>
+
+static DownloadOptions downloadOptions;  // Filled from the command line in main()
+static bool preflightBatches = false;     // Probe every URL of a batch before starting it
+static DownloadQueue *downloadQueue = nullptr;  // Runs batches larger than bulkThreshold
+static const int bulkThreshold = 20;
+static QString localClientId = "local";  // Queue client for batches submitted here, set by --client-id
+static bool crawlDirectories = false;     // Mirror URLs ending in '/' from their index pages
+static int crawlDepth = 5;
+static QString crawlAccept;               // Regular expressions on the file path below the root
+static QString crawlReject;
+static bool exitWhenDone = false;         // Quit once every download has finished or failed
+static int activeDownloads = 0;
+static int failedDownloads = 0;
+static bool decompressZstd = false;       // Decode seekable .zst downloads while they download
+
+// Called once per download when it finishes or fails
+void downloadEnded(bool failed) {
+    if (failed) {
+        failedDownloads++;
+    }
+    if (--activeDownloads == 0 && exitWhenDone) {
+        QCoreApplication::exit(failedDownloads > 0 ? 1 : 0);
+    }
+}
+
+void startDownload(const QString &url, QVBoxLayout *layout, QNetworkAccessManager *networkManager, QWidget *window,
+                   const QString &targetPath = QString()) {
+    QVBoxLayout *downloadLayout = new QVBoxLayout();
+    QLabel *urlLabel = new QLabel(url, window);
+    QProgressBar *progressBar = new QProgressBar(window);
+    QPushButton *pauseResumeButton = new QPushButton("Pause", window);
+
+    DownloadThread *downloadThread = new DownloadThread(networkManager, url, window);
+    DownloadOptions options = downloadOptions;
+    options.targetPath = targetPath;
+    bool decompress = decompressZstd && QUrl(url).path().endsWith(".zst") && options.encryptionKey.isEmpty();
+    if (decompress) {
+        options.streaming = true;  // The decoder follows contiguousOffsetChanged
+    }
+    downloadThread->setOptions(options);
+
+    if (decompress) {
+        QString finalPath = Downloader::localPath(url, options);
+        ZstdSeekableDecoder *decoder = new ZstdSeekableDecoder(
+            networkManager, url, options.staging ? StagingMover::stagedPath(finalPath) : finalPath, finalPath);
+        QObject::connect(downloadThread, &DownloadThread::contiguousOffsetChanged, decoder, &ZstdSeekableDecoder::inputAvailable);
+        QObject::connect(downloadThread, &DownloadThread::downloadFinished, decoder, &ZstdSeekableDecoder::inputFinished);
+        QObject::connect(downloadThread, &DownloadThread::downloadFailed, decoder, &ZstdSeekableDecoder::inputFailed);
+        QObject::connect(decoder, &ZstdSeekableDecoder::finished, [](const QString &outputPath, bool ok, const QString &error) {
+            if (ok) {
+                qInfo().noquote() << "Decompressed to" << outputPath;
+            } else {
+                qWarning().noquote() << "Not decompressed:" << outputPath << error;
+            }
+            downloadEnded(!ok);
+        });
+        QObject::connect(decoder, &ZstdSeekableDecoder::skipped, [](const QString &outputPath, const QString &reason) {
+            qInfo().noquote() << "Not decompressed:" << outputPath << "(" + reason + ")";
+            downloadEnded(false);  // Only a decode that was attempted and broke counts as a failure
+        });
+        activeDownloads++;  // --exit-when-done waits for the decoder too
+        decoder->start();
+    }
+
+    progressBar->setRange(0, 100);
+    progressBar->setValue(0);
+
+    downloadLayout->addWidget(urlLabel);
+    downloadLayout->addWidget(progressBar);
+    downloadLayout->addWidget(pauseResumeButton);
+
+    layout->addLayout(downloadLayout);
+
+    QObject::connect(downloadThread, &DownloadThread::downloadProgress, [=](qint64 bytesReceived, qint64 bytesTotal) {
+    if (bytesTotal == 0) {
+        // Handle indeterminate state
+        progressBar->setValue(0);  // Default to 0, or use progressBar->setRange(0, 0) for a "busy" indicator
+    } else {
+        // Normal progress calculation
+        progressBar->setValue(static_cast<int>((bytesReceived * 100) / bytesTotal));
+    }
+});
+
+    QObject::connect(downloadThread, &DownloadThread::rateUpdated, [=](double, double smoothed, qint64 etaSecs) {
+    QString eta = etaSecs < 0 ? "--:--" : QString("%1:%2").arg(etaSecs / 60).arg(etaSecs % 60, 2, 10, QChar('0'));
+    urlLabel->setText(url + "  " + QString::number(smoothed / (1024 * 1024), 'f', 2) + " MiB/s, ETA " + eta);
+});
+
+    QObject::connect(downloadThread, &DownloadThread::downloadFinished, [=](const QString &fileName) {
+    urlLabel->setText("Downloaded: " + fileName);
+    progressBar->setValue(100);
+    pauseResumeButton->setDisabled(true);
+
+    // Manual termination of the thread
+    downloadThread->quit();
+    downloadThread->wait();
+    downloadThread->deleteLater();  // Use Qt's deferred deletion to clean up safely
+    downloadEnded(false);
+});
+
+    QObject::connect(downloadThread, &DownloadThread::downloadFailed, [=](const QString &error) {
+    urlLabel->setText("Failed: " + error);
+    pauseResumeButton->setDisabled(true);
+
+    downloadThread->quit();
+    downloadThread->wait();
+    downloadThread->deleteLater();
+    downloadEnded(true);
+});
+
+    activeDownloads++;
+    downloadThread->start();
+}
+
+// Runs the URLs on the shared queue, with one summary row for all of them; targetPaths as for DownloadQueue::submit()
+void queueDownloads(const QStringList &urls, const QStringList &targetPaths, QVBoxLayout *layout, QWidget *window) {
+    static QLabel *queueLabel = nullptr;
+    static QProgressBar *queueBar = nullptr;
+    if (!queueLabel) {
+        queueLabel = new QLabel(window);
+        queueBar = new QProgressBar(window);
+        layout->addWidget(queueLabel);
+        layout->addWidget(queueBar);
+
+        // queueLabel as the context: the queue emits on its worker thread, these must run on the GUI thread
+        QObject::connect(downloadQueue, &DownloadQueue::queueProgress, queueLabel, [=](int queued, int active, int done, int failed) {
+            queueLabel->setText(QString("Queue: %1 waiting, %2 active, %3 done, %4 failed").arg(queued).arg(active).arg(done).arg(failed));
+            int total = queued + active + done + failed;
+            queueBar->setValue(total > 0 ? (done + failed) * 100 / total : 0);
+        });
+        // Only jobs submitted from here; a JobWorker reports its own to the coordinator
+        QObject::connect(downloadQueue, &DownloadQueue::jobsFinished, queueLabel, [](const QVector<DownloadQueue::JobResult> &results) {
+            for (const DownloadQueue::JobResult &result : results) {
+                if (result.clientId == localClientId) {
+                    downloadEnded(false);
+                }
+            }
+        });
+        QObject::connect(downloadQueue, &DownloadQueue::jobsFailed, queueLabel, [](const QVector<DownloadQueue::JobResult> &results) {
+            for (const DownloadQueue::JobResult &result : results) {
+                if (result.clientId != localClientId) {
+                    continue;
+                }
+                qWarning().noquote() << result.url << result.error;
+                downloadEnded(true);
+            }
+        });
+    }
+
+    activeDownloads += urls.size();
+    downloadQueue->submit(urls, localClientId, targetPaths);
+}
+
+// Large batches go through the shared queue instead of a thread and a row per URL
+void startDownloads(const QStringList &urls, QVBoxLayout *layout, QNetworkAccessManager *networkManager, QWidget *window) {
+    if (urls.size() <= bulkThreshold) {
+        for (const QString &url : urls) {
+            startDownload(url, layout, networkManager, window);  // Start download for each URL
+        }
+        return;
+    }
+    queueDownloads(urls, QStringList(), layout, window);
+}
+
+// Mirrors a directory tree served as index pages; files start downloading as soon as they are listed
+void crawlDirectory(const QString &url, QVBoxLayout *layout, QNetworkAccessManager *networkManager, QWidget *window) {
+    QUrl root(url);
+    QString localRoot = QDir::homePath() + "/qt_downloads/" + root.host() + root.path();
+
+    IndexCrawler *crawler = new IndexCrawler(networkManager, window);
+    crawler->setMaxDepth(crawlDepth);
+    crawler->setFilters(crawlAccept, crawlReject);
+    crawler->setLocalRoot(localRoot);
+
+    // A mirror can list thousands of files: they go to the queue, gathered into one submission per batch
+    static const int crawlBatchSize = 256;
+    static const int crawlBatchMsecs = 200;
+    QSharedPointer<QPair<QStringList, QStringList>> batch(new QPair<QStringList, QStringList>());  // URLs, targets
+    QTimer *batchTimer = new QTimer(crawler);
+    batchTimer->setSingleShot(true);
+    batchTimer->setInterval(crawlBatchMsecs);
+    auto submitBatch = [=]() {
+        batchTimer->stop();
+        if (!batch->first.isEmpty()) {
+            queueDownloads(batch->first, batch->second, layout, window);
+            batch->first.clear();
+            batch->second.clear();
+        }
+    };
+    QObject::connect(batchTimer, &QTimer::timeout, submitBatch);
+
+    activeDownloads++;  // Keeps --exit-when-done waiting until the crawl is over
+    QObject::connect(crawler, &IndexCrawler::fileDiscovered, [=](const QUrl &fileUrl, const QString &relativePath) {
+        batch->first.append(fileUrl.toString());
+        batch->second.append(localRoot + relativePath);
+        if (batch->first.size() >= crawlBatchSize) {
+            submitBatch();
+        } else if (!batchTimer->isActive()) {
+            batchTimer->start();
+        }
+    });
+    QObject::connect(crawler, &IndexCrawler::finished, [=]() {
+        submitBatch();
+        qInfo().noquote() << crawler->summary();
+        crawler->deleteLater();
+        downloadEnded(false);
+    });
+    crawler->crawl(root);
+}
+
+// Room for a probed batch on every volume its files pass through: scratch first when staging,
+// then the destination, which keeps the bulk reserve free. Only bytes still missing locally
+// count, and downloads already running claim what they have left. Empty when it all fits.
+QString checkDiskSpace(const QList<PreflightProber::ProbeResult> &results) {
+    struct Volume {
+        QString path;        // One path on it, for the message
+        qint64 needed = 0;
+        qint64 reserve = 0;
+        bool scratch = false;
+    };
+    QHash<QByteArray, Volume> volumes;  // By device
+    auto directoryOf = [](const QString &path) {
+        QString dir = QFileInfo(path).absolutePath();
+        while (!QFileInfo::exists(dir) && dir != QDir::rootPath()) {
+            dir = QFileInfo(dir).absolutePath();  // The target directory may not have been created yet
+        }
+        return dir;
+    };
+    auto claim = [&](const QString &dir, qint64 bytes, bool scratch, qint64 reserve) {
+        Volume &volume = volumes[QStorageInfo(dir).device()];
+        volume.path = dir;
+        volume.needed += qMax<qint64>(0, bytes);
+        volume.scratch = volume.scratch || scratch;
+        volume.reserve = qMax(volume.reserve, reserve);
+    };
+    auto claimFile = [&](const QString &writePath, const QString &finalPath, qint64 size) {
+        QString writeDir = directoryOf(writePath);
+        QString finalDir = directoryOf(finalPath);
+        if (QStorageInfo(writeDir).device() == QStorageInfo(finalDir).device()) {
+            claim(finalDir, size - QFileInfo(writePath).size(), false, 0);  // Stays there; a staged move is a rename
+            return;
+        }
+        claim(writeDir, size - QFileInfo(writePath).size(), true, 0);
+        claim(finalDir, size, false, StagingMover::bulkReserveBytes());  // Copied there whole once complete
+    };
+
+    for (const PreflightProber::ProbeResult &result : results) {
+        if (result.ok && result.size > 0) {
+            QString finalPath = Downloader::localPath(result.url, downloadOptions);
+            claimFile(downloadOptions.staging ? StagingMover::stagedPath(finalPath) : finalPath, finalPath, result.size);
+        }
+    }
+    for (const Downloader::InFlight &running : Downloader::inFlight()) {
+        claimFile(running.writePath, running.finalPath, running.totalBytes);
+    }
+
+    for (const Volume &volume : qAsConst(volumes)) {
+        qint64 needed = volume.needed;
+        if (volume.scratch && StagingMover::scratchBudgetBytes() > 0) {
+            needed = qMin(needed, StagingMover::scratchBudgetBytes());  // The mover drains it as files complete
+        }
+        qint64 available = QStorageInfo(volume.path).bytesAvailable() - volume.reserve;
+        if (needed > available) {
+            return QString("Batch needs %1 MiB on %2 but only %3 MiB are free%4; not started.")
+                .arg(needed / (1024 * 1024)).arg(volume.path).arg(qMax<qint64>(0, available) / (1024 * 1024))
+                .arg(volume.reserve > 0 ? " above the bulk reserve" : "");
+        }
+    }
+    return QString();
+}
+
+// Slot to handle start download button click
+void onStartDownloadButtonClicked(QLineEdit *urlInput, QVBoxLayout *layout, QNetworkAccessManager *networkManager, QWidget *window) {
+    QString inputUrls = urlInput->text();  // Get comma-separated URLs
+    QStringList urls = inputUrls.split(",", QString::SkipEmptyParts);  // Split into list of URLs
+    for (QString &url : urls) {
+        url = url.trimmed();
+    }
+
+    if (crawlDirectories) {
+        QStringList files;
+        for (const QString &url : urls) {
+            if (url.endsWith('/')) {
+                crawlDirectory(url, layout, networkManager, window);
+            } else {
+                files.append(url);
+            }
+        }
+        urls = files;
+    }
+
+    if (!preflightBatches) {
+        startDownloads(urls, layout, networkManager, window);
+        return;
+    }
+
+    QLabel *summaryLabel = new QLabel("Checking " + QString::number(urls.size()) + " URLs...", window);
+    layout->addWidget(summaryLabel);
+
+    PreflightProber *prober = new PreflightProber(networkManager, window);
+    QObject::connect(prober, &PreflightProber::finished, [=]() {
+        prober->deleteLater();
+        qInfo().noquote() << prober->summary();
+
+        QString shortfall = checkDiskSpace(prober->results());
+        if (!shortfall.isEmpty()) {
+            summaryLabel->setText(shortfall);
+            return;
+        }
+
+        summaryLabel->setText(prober->summary().trimmed());
+        QStringList live;
+        for (const PreflightProber::ProbeResult &result : prober->results()) {
+            if (result.ok) {
+                live.append(result.url);  // Dead URLs are listed, not started
+            }
+        }
+        startDownloads(live, layout, networkManager, window);
+    });
+    prober->probe(urls);
+}
+
+// Function to load unfinished downloads (optional)
+void loadUnfinishedDownloads(QVBoxLayout *layout, QWidget *window, QNetworkAccessManager *networkManager) {
+    QDir progressDir(QDir::homePath() + "/progress");
+    QStringList resumeUrls, resumeTargets;
+    if (progressDir.exists()) {
+        QStringList progressFiles = progressDir.entryList(QDir::Files);
+        for (const QString &progressFileName : progressFiles) {
+            QFile progressFile(progressDir.filePath(progressFileName));
+            if (progressFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
+                QTextStream stream(&progressFile);
+                QString url;
+                QString target;  // Empty in journals from before targets were recorded
+                qint64 downloadedBytes = 0;
+                QString status;  // Add a variable to track the status
+
+                while (!stream.atEnd()) {
+                    QString line = stream.readLine();
+                    if (line.startsWith("Download URL:")) {
+                        url = line.section(":", 1).trimmed();
+                    } else if (line.startsWith("Target:")) {
+                        target = line.section(":", 1).trimmed();
+                    } else if (line.startsWith("Downloaded:")) {
+                        downloadedBytes = line.section(":", 1).trimmed().toLongLong();
+                    } else if (line.startsWith("Status:")) {  // New line for status
+                        status = line.section(":", 1).trimmed();
+                    }
+                }
+
+                // Nothing is running yet, so "in-progress" means the last run was killed mid-download
+                if (!url.isEmpty() && status != "completed") {
+                    progressFile.close();
+                    DownloadOptions options = downloadOptions;
+                    options.targetPath = target;
+                    QString current = Downloader::journalPath(url, options);
+                    if (progressFile.fileName() != current) {
+                        // Named by file name only, as older runs did; if the new journal exists too, it wins
+                        if (QFile::exists(current)) {
+                            QFile::remove(progressFile.fileName());
+                            continue;
+                        }
+                        QFile::rename(progressFile.fileName(), current);
+                    }
+                    resumeUrls.append(url);
+                    resumeTargets.append(target);
+                }
+            }
+        }
+    }
+
+    // An interrupted mirror can leave thousands of journals: resume those through the queue too
+    if (resumeUrls.size() > bulkThreshold) {
+        queueDownloads(resumeUrls, resumeTargets, layout, window);
+        return;
+    }
+    for (int i = 0; i < resumeUrls.size(); ++i) {
+        startDownload(resumeUrls[i], layout, networkManager, window, resumeTargets[i]);
+    }
+}
+int main(int argc, char *argv[]) {
+    QApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption streamingOption("streaming", "Grow the file strictly in order so readers can tail it.");
+    QCommandLineOption readAheadOption("read-ahead", "Read-ahead window in KiB for streaming mode.", "kib");
+    QCommandLineOption noHttp2Option("no-http2", "Use a separate HTTP/1.1 connection per download.");
+    QCommandLineOption priorityOption("priority", "Download priority: high, normal or low.", "level");
+    QCommandLineOption noHappyEyeballsOption("no-happy-eyeballs", "Do not race IPv6 and IPv4 connects to new hosts.");
+    QCommandLineOption httpCacheOption("http-cache", "Keep an on-disk HTTP cache of up to this many MiB.", "mib");
+    QCommandLineOption preflightOption("preflight", "Probe all URLs of a batch for size and range support first.");
+    QCommandLineOption dedupOption("dedup", "Replace completed files that duplicate earlier downloads with links.");
+    QCommandLineOption verifyTailOption("verify-tail", "On resume, re-fetch and compare the last KiB of the file.", "kib");
+    QCommandLineOption exitWhenDoneOption("exit-when-done", "Quit when all downloads end; exit code 1 if any failed.");
+    QCommandLineOption durabilityOption("durability", "When to fsync data and journal: none, periodic or barrier.", "policy");
+    QCommandLineOption syncIntervalOption("sync-interval", "Milliseconds between periodic syncs.", "msecs");
+    QCommandLineOption recursiveOption("recursive", "Mirror URLs ending in '/' by crawling their index pages.");
+    QCommandLineOption depthOption("depth", "How many directory levels to descend when crawling.", "levels");
+    QCommandLineOption acceptOption("accept", "Only mirror files whose path matches this regular expression.", "regex");
+    QCommandLineOption rejectOption("reject", "Skip files whose path matches this regular expression.", "regex");
+    QCommandLineOption sourceAddressOption("source-address", "Local address to send from; repeat to spread over several.", "address");
+    QCommandLineOption ioClassOption("io-class", "I/O priority class for disk writes: realtime, best-effort or idle.", "class");
+    QCommandLineOption ioLevelOption("io-level", "I/O priority level 0-7 within the class.", "level");
+    QCommandLineOption writeLatencyOption("max-write-latency", "Slow down writes when p99 write latency exceeds this.", "msecs");
+    QCommandLineOption maxActiveOption("max-active", "Downloads the batch queue runs at once.", "count");
+    QCommandLineOption peerPortOption("peer-port", "Share completed downloads with LAN peers, serving on this port.", "port");
+    QCommandLineOption proxyPortOption("proxy-port", "Run a caching HTTP proxy for other tools on this localhost port.", "port");
+    QCommandLineOption proxyMaxAgeOption("proxy-max-age", "Seconds a proxied file is served from cache (default 86400).", "seconds");
+    QCommandLineOption pinNicOption("pin-nic", "Pin download workers to the NUMA node of this network interface.", "interface");
+    QCommandLineOption encryptKeyOption("encrypt-key-file", "Store downloads encrypted with the AES-256 key in this file.", "path");
+    QCommandLineOption decryptOption("decrypt", "Print the plaintext of a file stored with --encrypt-key-file, then exit.", "file");
+    QCommandLineOption clientMaxActiveOption("client-max-active", "Queue slots one client may use at once.", "count");
+    QCommandLineOption clientMaxQueuedOption("client-max-queued", "Jobs one client may have waiting in the queue.", "count");
+    QCommandLineOption clientDailyBytesOption("client-daily-bytes", "Bytes one client may download per day through the queue.", "bytes");
+    QCommandLineOption clientIdOption("client-id", "Queue client that batches from this instance are charged to (default: local).", "name");
+    QCommandLineOption loopLagOption("loop-lag-threshold", "Monitor event loop lag and log a stack when a loop stalls this long.", "msecs");
+    QCommandLineOption decompressOption("decompress-zst", "Decompress seekable .zst downloads in parallel while they download.");
+    QCommandLineOption stageDirOption("stage-dir", "Download into this fast scratch directory, then move files to their destination.", "path");
+    QCommandLineOption stageBudgetOption("stage-budget", "Bytes the scratch directory may hold before downloads are throttled.", "bytes");
+    QCommandLineOption bulkReserveOption("bulk-reserve", "Free bytes to leave on the destination volume when moving staged files.", "bytes");
+    QCommandLineOption coordinatorOption("coordinator", "Hand the URLs out to --worker-of instances connecting on this port.", "port");
+    QCommandLineOption workerOfOption("worker-of", "Take jobs from the coordinator at host:port.", "host:port");
+    QCommandLineOption coordinatorBindOption("coordinator-bind", "Address the coordinator listens on (default: 127.0.0.1).", "address");
+    QCommandLineOption coordinatorSecretOption("coordinator-secret-file", "Shared secret workers must prove to the coordinator.", "path");
+    QCommandLineOption peerDiscoveryOption("peer-discovery-port", "UDP port for peer announcements (default 45454).", "port");
+    parser.addPositionalArgument("urls", "URLs to download right away.", "[urls...]");
+    parser.addOption(streamingOption);
+    parser.addOption(readAheadOption);
+    parser.addOption(noHttp2Option);
+    parser.addOption(priorityOption);
+    parser.addOption(noHappyEyeballsOption);
+    parser.addOption(httpCacheOption);
+    parser.addOption(preflightOption);
+    parser.addOption(dedupOption);
+    parser.addOption(verifyTailOption);
+    parser.addOption(exitWhenDoneOption);
+    parser.addOption(durabilityOption);
+    parser.addOption(syncIntervalOption);
+    parser.addOption(recursiveOption);
+    parser.addOption(depthOption);
+    parser.addOption(acceptOption);
+    parser.addOption(rejectOption);
+    parser.addOption(sourceAddressOption);
+    parser.addOption(ioClassOption);
+    parser.addOption(ioLevelOption);
+    parser.addOption(writeLatencyOption);
+    parser.addOption(maxActiveOption);
+    parser.addOption(peerPortOption);
+    parser.addOption(peerDiscoveryOption);
+    parser.addOption(pinNicOption);
+    parser.addOption(encryptKeyOption);
+    parser.addOption(decryptOption);
+    parser.addOption(clientMaxActiveOption);
+    parser.addOption(clientMaxQueuedOption);
+    parser.addOption(clientDailyBytesOption);
+    parser.addOption(clientIdOption);
+    parser.addOption(loopLagOption);
+    parser.addOption(decompressOption);
+    parser.addOption(stageDirOption);
+    parser.addOption(stageBudgetOption);
+    parser.addOption(bulkReserveOption);
+    parser.addOption(coordinatorOption);
+    parser.addOption(workerOfOption);
+    parser.addOption(coordinatorBindOption);
+    parser.addOption(coordinatorSecretOption);
+    parser.addOption(proxyPortOption);
+    parser.addOption(proxyMaxAgeOption);
+    parser.process(a);
+
+    downloadOptions.streaming = parser.isSet(streamingOption);
+    if (parser.isSet(readAheadOption)) {
+        // 0 would mean an unlimited reply buffer to Qt, which turns back-pressure off entirely
+        bool ok = false;
+        qint64 kib = parser.value(readAheadOption).toLongLong(&ok);
+        if (!ok || kib <= 0) {
+            qCritical() << "--read-ahead must be a positive number of KiB, not" << parser.value(readAheadOption);
+            return 1;
+        }
+        downloadOptions.readAheadBytes = kib * 1024;
+    }
+    downloadOptions.http2 = !parser.isSet(noHttp2Option);
+    downloadOptions.happyEyeballs = !parser.isSet(noHappyEyeballsOption);
+    preflightBatches = parser.isSet(preflightOption);
+    downloadOptions.dedup = parser.isSet(dedupOption);
+    downloadOptions.verifyTailBytes = parser.value(verifyTailOption).toLongLong() * 1024;
+    exitWhenDone = parser.isSet(exitWhenDoneOption);
+    if (parser.value(durabilityOption) == "periodic") {
+        downloadOptions.durability = DurabilityPolicy::Periodic;
+    } else if (parser.value(durabilityOption) == "barrier") {
+        downloadOptions.durability = DurabilityPolicy::Barrier;
+    } else if (parser.isSet(durabilityOption) && parser.value(durabilityOption) != "none") {
+        qCritical() << "--durability must be none, periodic or barrier, not" << parser.value(durabilityOption);
+        return 1;
+    }
+    if (parser.isSet(syncIntervalOption)) {
+        bool ok = false;
+        downloadOptions.syncIntervalMsecs = parser.value(syncIntervalOption).toInt(&ok);
+        if (!ok || downloadOptions.syncIntervalMsecs <= 0) {
+            qCritical() << "--sync-interval must be a positive number of milliseconds, not" << parser.value(syncIntervalOption);
+            return 1;
+        }
+    }
+    if (parser.value(priorityOption) == "high") {
+        downloadOptions.priority = QNetworkRequest::HighPriority;
+    } else if (parser.value(priorityOption) == "low") {
+        downloadOptions.priority = QNetworkRequest::LowPriority;
+    } else if (parser.isSet(priorityOption) && parser.value(priorityOption) != "normal") {
+        qCritical() << "--priority must be high, normal or low, not" << parser.value(priorityOption);
+        return 1;
+    }
+    crawlDirectories = parser.isSet(recursiveOption);
+    if (parser.isSet(depthOption)) {
+        crawlDepth = parser.value(depthOption).toInt();
+    }
+    crawlAccept = parser.value(acceptOption);
+    const QStringList ioClasses = {"realtime", "best-effort", "idle"};
+    downloadOptions.ioPriorityClass = ioClasses.indexOf(parser.value(ioClassOption)) + 1;
+    if (parser.isSet(ioClassOption) && downloadOptions.ioPriorityClass == 0) {
+        qCritical() << "--io-class must be realtime, best-effort or idle, not" << parser.value(ioClassOption);
+        return 1;
+    }
+    if (parser.isSet(ioLevelOption)) {
+        bool ok = false;
+        downloadOptions.ioPriorityLevel = parser.value(ioLevelOption).toInt(&ok);
+        if (!ok || downloadOptions.ioPriorityLevel < 0 || downloadOptions.ioPriorityLevel > 7) {
+            qCritical() << "--io-level must be 0 to 7, not" << parser.value(ioLevelOption);
+            return 1;
+        }
+    }
+    downloadOptions.writeLatencyThresholdMsecs = parser.value(writeLatencyOption).toInt();
+    decompressZstd = parser.isSet(decompressOption);
+    if (parser.isSet(stageDirOption)) {
+        StagingMover::configure(parser.value(stageDirOption), parser.value(stageBudgetOption).toLongLong(),
+                                parser.value(bulkReserveOption).toLongLong());
+        QObject::connect(&a, &QCoreApplication::aboutToQuit, []() { StagingMover::shutdown(); });
+        downloadOptions.staging = true;
+    }
+    downloadOptions.loopLagThresholdMsecs = parser.value(loopLagOption).toInt();
+    if (downloadOptions.loopLagThresholdMsecs > 0) {
+        LoopLagMonitor::install("gui", downloadOptions.loopLagThresholdMsecs);
+        QObject::connect(&a, &QCoreApplication::aboutToQuit, []() { LoopLagMonitor::shutdown(); });
+    }
+    if (parser.isSet(encryptKeyOption)) {
+        downloadOptions.encryptionKey = FileCipher::loadKey(parser.value(encryptKeyOption));
+        if (downloadOptions.encryptionKey.isEmpty()) {
+            qCritical() << "Cannot use" << parser.value(encryptKeyOption) << "as a key: expected 32 bytes or 64 hex digits";
+            return 1;  // Never fall back to writing plaintext
+        }
+    }
+    if (parser.isSet(decryptOption)) {
+        if (downloadOptions.encryptionKey.isEmpty()) {
+            qCritical() << "--decrypt needs the key: pass --encrypt-key-file as well";
+            return 1;
+        }
+        QFile output;
+        output.open(stdout, QIODevice::WriteOnly);
+        if (!FileCipher::decryptFile(parser.value(decryptOption), downloadOptions.encryptionKey, &output)) {
+            qCritical() << "Cannot decrypt" << parser.value(decryptOption) << "(missing or incomplete .iv file?)";
+            return 1;
+        }
+        return 0;
+    }
+    if (parser.isSet(pinNicOption)) {
+        downloadOptions.pinToNicNode = NumaPlacement::setInterface(parser.value(pinNicOption));
+        if (!downloadOptions.pinToNicNode) {
+            qWarning() << "Not pinning workers: no NUMA node known for" << parser.value(pinNicOption);
+        }
+    }
+    if (parser.isSet(peerPortOption)) {
+        quint16 discoveryPort = parser.isSet(peerDiscoveryOption) ? parser.value(peerDiscoveryOption).toUShort() : 45454;
+        downloadOptions.peerCache = PeerCache::start(parser.value(peerPortOption).toUShort(), discoveryPort);
+        if (!downloadOptions.peerCache) {
+            qWarning() << "Peer cache disabled: cannot listen on the peer ports";
+        }
+        QObject::connect(&a, &QCoreApplication::aboutToQuit, []() { PeerCache::shutdown(); });
+    }
+    crawlReject = parser.value(rejectOption);
+
+    // Print connection count against throughput per host so the HTTP/2 setting can be tuned
+    QObject::connect(&a, &QCoreApplication::aboutToQuit, []() {
+        qInfo().noquote() << DownloadMetrics::report() + SourceAddressPool::report();
+    });
+
+    QWidget window;
+    QVBoxLayout *layout = new QVBoxLayout(&window);
+    QNetworkAccessManager *networkManager = new BindingNetworkAccessManager(&window);
+
+    QList<QHostAddress> sourceAddresses;
+    for (const QString &address : parser.values(sourceAddressOption)) {
+        sourceAddresses.append(QHostAddress(address));
+    }
+    SourceAddressPool::setAddresses(sourceAddresses);
+
+    qint64 httpCacheBytes = parser.value(httpCacheOption).toLongLong() * 1024 * 1024;
+    if (httpCacheBytes > 0) {
+        // QNetworkDiskCache refuses entries larger than 3/4 of its size, so big downloads bypass it
+        QNetworkDiskCache *diskCache = new QNetworkDiskCache(networkManager);
+        diskCache->setCacheDirectory(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/http");
+        diskCache->setMaximumCacheSize(httpCacheBytes);
+        networkManager->setCache(diskCache);
+        downloadOptions.httpCache = true;
+    }
+
+    downloadQueue = new DownloadQueue();
+    QObject::connect(&a, &QCoreApplication::aboutToQuit, []() { delete downloadQueue; });
+    downloadQueue->setOptions(downloadOptions);
+    if (parser.isSet(maxActiveOption)) {
+        downloadQueue->setMaxActive(parser.value(maxActiveOption).toInt());
+    }
+    DownloadQueue::ClientQuota clientQuota;
+    clientQuota.maxActive = parser.value(clientMaxActiveOption).toInt();
+    clientQuota.maxQueued = parser.value(clientMaxQueuedOption).toInt();
+    clientQuota.bytesPerDay = parser.value(clientDailyBytesOption).toLongLong();
+    downloadQueue->setClientQuota(clientQuota);
+    if (parser.isSet(clientIdOption) && !parser.value(clientIdOption).isEmpty()) {
+        localClientId = parser.value(clientIdOption);
+    }
+
+    static ProxyServer *proxyServer = nullptr;
+    if (parser.isSet(proxyPortOption)) {
+        qint64 maxAgeSecs = parser.isSet(proxyMaxAgeOption) ? parser.value(proxyMaxAgeOption).toLongLong() : 86400;
+        proxyServer = new ProxyServer(QDir::homePath() + "/qt_downloads/.proxy", maxAgeSecs);
+        QObject::connect(&a, &QCoreApplication::aboutToQuit, []() { delete proxyServer; });
+        proxyServer->setOptions(downloadOptions);
+        if (httpCacheBytes > 0) {
+            proxyServer->setHttpCacheDirectory(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/http");
+        }
+        proxyServer->listen(parser.value(proxyPortOption).toUShort());
+    }
+
+    window.setWindowTitle("Download Manager");
+    window.setLayout(layout);
+    window.resize(400, 300);
+
+    QLineEdit *urlInput = new QLineEdit(&window);
+    QPushButton *startDownloadButton = new QPushButton("Start Download", &window);
+
+    layout->addWidget(urlInput);
+    layout->addWidget(startDownloadButton);
+
+    QObject::connect(startDownloadButton, &QPushButton::clicked, [&]() {
+        onStartDownloadButtonClicked(urlInput, layout, networkManager, &window);
+    });
+
+    loadUnfinishedDownloads(layout, &window, networkManager);
+
+    QByteArray coordinatorSecret;
+    if (parser.isSet(coordinatorSecretOption)) {
+        QFile secretFile(parser.value(coordinatorSecretOption));
+        if (!secretFile.open(QIODevice::ReadOnly) || (coordinatorSecret = secretFile.readAll().trimmed()).isEmpty()) {
+            qCritical() << "Cannot read the coordinator secret from" << parser.value(coordinatorSecretOption);
+            return 1;
+        }
+    }
+
+    if (parser.isSet(workerOfOption)) {
+        QString coordinatorAddress = parser.value(workerOfOption);
+        int capacity = parser.isSet(maxActiveOption) ? parser.value(maxActiveOption).toInt() : 4;
+        JobWorker *worker = new JobWorker(coordinatorAddress.section(':', 0, -2), coordinatorAddress.section(':', -1).toUShort(),
+                                          downloadQueue, capacity, &a);
+        worker->setSecret(coordinatorSecret);
+        QObject::connect(worker, &JobWorker::batchDone, [](int failed) {
+            qInfo() << "Coordinator has no more work;" << failed << "job(s) failed here";
+            if (exitWhenDone) {
+                QCoreApplication::exit(failed > 0 ? 1 : 0);
+            }
+        });
+        worker->start();
+    }
+
+    if (parser.isSet(coordinatorOption)) {
+        // The URLs are the batch to hand out; nothing is downloaded here
+        JobCoordinator *coordinator = new JobCoordinator(&a);
+        coordinator->setSecret(coordinatorSecret);
+        QHostAddress bindAddress = parser.isSet(coordinatorBindOption) ? QHostAddress(parser.value(coordinatorBindOption))
+                                                                       : QHostAddress(QHostAddress::LocalHost);
+        if (bindAddress.isNull()) {
+            qCritical() << "Not an address:" << parser.value(coordinatorBindOption);
+            return 1;
+        }
+        if (!coordinator->listen(parser.value(coordinatorOption).toUShort(), bindAddress)) {
+            qCritical() << "Cannot listen for workers on port" << parser.value(coordinatorOption);
+            return 1;
+        }
+        QObject::connect(coordinator, &JobCoordinator::jobEnded, [](const QString &, bool failed, const QString &) {
+            downloadEnded(failed);
+        });
+        activeDownloads += parser.positionalArguments().size();
+        coordinator->addJobs(parser.positionalArguments());
+        window.show();
+        return a.exec();
+    }
+
+    for (const QString &url : parser.positionalArguments()) {
+        if (crawlDirectories && url.endsWith('/')) {
+            crawlDirectory(url, layout, networkManager, &window);
+            continue;
+        }
+        // A URL with a progress file was just resumed by loadUnfinishedDownloads()
+        if (!QFile::exists(Downloader::journalPath(url, downloadOptions))) {
+            startDownload(url, layout, networkManager, &window);
+        }
+    }
+
+    window.show();
+
+    return a.exec();
+}
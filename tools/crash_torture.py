@@ -0,0 +1,196 @@
+#!/usr/bin/env python3
+"""Kill -9 torture test for the download engine.
+
+Serves a set of random files from a local HTTP server (with Range support and a per-connection
+rate limit, so kills land mid-transfer), starts the engine on all of them, SIGKILLs it at random
+points, restarts it, and repeats. After the last kill the engine runs to completion and every file
+is compared byte for byte (SHA-256) with its source.
+
+Bytes re-downloaded are counted on the server side: for each run, the bytes the server sent minus
+the growth of the files on disk. Their sum is the total the server sent beyond the file sizes.
+
+The engine runs with HOME pointed at a scratch directory, so ~/qt_downloads and ~/progress are
+private to the test. Note that SIGKILL keeps the page cache: this measures what the journal and
+resume logic lose, not what an unflushed disk cache would lose on power failure.
+
+    tools/crash_torture.py --engine ./build/QT-Download-Manager --kills 50 -- --durability periodic
+"""
+
+import argparse
+import hashlib
+import http.server
+import os
+import random
+import shutil
+import signal
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+
+class Counter:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.sent = 0
+
+    def add(self, n):
+        with self.lock:
+            self.sent += n
+
+    def value(self):
+        with self.lock:
+            return self.sent
+
+
+def make_handler(files, counter, rate):
+    class Handler(http.server.BaseHTTPRequestHandler):
+        protocol_version = "HTTP/1.1"
+
+        def log_message(self, fmt, *args):
+            pass
+
+        def do_HEAD(self):
+            self.serve(head=True)
+
+        def do_GET(self):
+            self.serve(head=False)
+
+        def serve(self, head):
+            data = files.get(self.path.lstrip("/"))
+            if data is None:
+                self.send_error(404)
+                return
+            start, end = 0, len(data) - 1
+            status = 200
+            header = self.headers.get("Range")
+            if header and header.startswith("bytes="):
+                first, _, last = header[6:].partition("-")
+                start = int(first) if first else 0
+                end = min(int(last), len(data) - 1) if last else len(data) - 1
+                if start >= len(data) or start > end:
+                    self.send_response(416)
+                    self.send_header("Content-Range", "bytes */%d" % len(data))
+                    self.send_header("Content-Length", "0")
+                    self.end_headers()
+                    return
+                status = 206
+            self.send_response(status)
+            self.send_header("Accept-Ranges", "bytes")
+            self.send_header("Content-Length", str(end - start + 1))
+            if status == 206:
+                self.send_header("Content-Range", "bytes %d-%d/%d" % (start, end, len(data)))
+            self.end_headers()
+            if head:
+                return
+            chunk = max(1024, rate // 20)
+            pos = start
+            try:
+                while pos <= end:
+                    piece = data[pos:min(pos + chunk, end + 1)]
+                    self.wfile.write(piece)
+                    counter.add(len(piece))
+                    pos += len(piece)
+                    time.sleep(len(piece) / rate)
+            except (BrokenPipeError, ConnectionResetError):
+                pass
+
+    return Handler
+
+
+def file_sizes(root, names):
+    sizes = {}
+    for name in names:
+        path = os.path.join(root, name)
+        sizes[name] = os.path.getsize(path) if os.path.exists(path) else 0
+    return sizes
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--engine", required=True, help="path to the built download manager")
+    parser.add_argument("--files", type=int, default=8, help="concurrent downloads")
+    parser.add_argument("--size", type=int, default=8 << 20, help="bytes per file")
+    parser.add_argument("--rate", type=int, default=4 << 20, help="bytes/s per connection")
+    parser.add_argument("--kills", type=int, default=20, help="SIGKILLs before the final run")
+    parser.add_argument("--min-run", type=float, default=0.2, help="shortest run before a kill, seconds")
+    parser.add_argument("--max-run", type=float, default=2.0, help="longest run before a kill, seconds")
+    parser.add_argument("--timeout", type=float, default=600, help="limit for the final run, seconds")
+    parser.add_argument("--seed", type=int, default=None)
+    parser.add_argument("--keep", action="store_true", help="keep the scratch directory")
+    parser.add_argument("engine_args", nargs="*", help="extra engine options, after --")
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    files = {"file%02d.bin" % i: rng.randbytes(args.size) for i in range(args.files)}
+    counter = Counter()
+    server = http.server.ThreadingHTTPServer(("127.0.0.1", 0), make_handler(files, counter, args.rate))
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    urls = ["http://127.0.0.1:%d/%s" % (server.server_address[1], name) for name in files]
+
+    home = tempfile.mkdtemp(prefix="crash-torture-")
+    downloads = os.path.join(home, "qt_downloads")
+    env = dict(os.environ, HOME=home, QT_QPA_PLATFORM=os.environ.get("QT_QPA_PLATFORM", "offscreen"))
+    command = [args.engine, "--exit-when-done"] + args.engine_args + urls
+
+    def run(limit, final=False):
+        before_sent = counter.value()
+        before_sizes = file_sizes(downloads, files)
+        engine = subprocess.Popen(command, env=env, stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                                  start_new_session=True)
+        try:
+            output, _ = engine.communicate(timeout=limit)
+            killed = False
+        except subprocess.TimeoutExpired:
+            os.killpg(engine.pid, signal.SIGTERM if final else signal.SIGKILL)  # Wrapper scripts too
+            output, _ = engine.communicate()
+            killed = not final
+        sent = counter.value() - before_sent
+        growth = sum(file_sizes(downloads, files).values()) - sum(before_sizes.values())
+        return killed, engine.returncode, sent, sent - growth, output.decode(errors="replace")
+
+    print("%d files of %d bytes, %d kills, scratch %s" % (args.files, args.size, args.kills, home))
+    kills = 0
+    for i in range(args.kills):
+        killed, code, sent, waste, _ = run(rng.uniform(args.min_run, args.max_run))
+        if not killed:
+            print("run %d: engine exited (%d) before the kill, stopping early" % (i + 1, code))
+            break
+        kills += 1
+        print("kill %3d: %10d bytes sent, %10d re-downloaded" % (i + 1, sent, waste))
+
+    _, code, sent, waste, output = run(args.timeout, final=True)
+    print("final   : %10d bytes sent, %10d re-downloaded, exit code %d" % (sent, waste, code))
+
+    failures = 0
+    for name, data in files.items():
+        path = os.path.join(downloads, name)
+        if not os.path.exists(path):
+            print("MISSING  %s" % name)
+            failures += 1
+            continue
+        with open(path, "rb") as f:
+            got = hashlib.sha256(f.read()).hexdigest()
+        if got != hashlib.sha256(data).hexdigest():
+            print("MISMATCH %s (%d of %d bytes)" % (name, os.path.getsize(path), len(data)))
+            failures += 1
+
+    total = counter.value() - args.files * args.size
+    print("re-downloaded: %d bytes total (%.1f%% of %d), %.0f per crash"
+          % (total, 100.0 * total / (args.files * args.size), args.files * args.size,
+             total / max(1, kills)))
+    if failures or code != 0:
+        print(output)
+        print("FAILED: %d of %d files wrong" % (failures, args.files))
+    else:
+        print("OK: all %d files byte-exact" % args.files)
+
+    server.shutdown()
+    if not args.keep:
+        shutil.rmtree(home, ignore_errors=True)
+    return 1 if failures or code != 0 else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())